@@ -270,7 +270,7 @@ void _(merge_spawn_pass)(void * arg)
     pmergesort_pass_context_t * pass_ctx = arg;
     aux_t * aux = &pass_ctx->auxes[0];
 
-    if (aux->rc == 0)
+    if (aux->rc == 0 && !_cancelled(pass_ctx->ctx, aux))
     {
 #if PMR_PARALLEL_USE_GCD && !_PMR_GCD_OVERCOMMIT
         dispatch_semaphore_wait(pass_ctx->ctx->thpool->mutex, DISPATCH_TIME_FOREVER); /* semaphore to prevent the threads overcommit flood */
@@ -281,6 +281,9 @@ void _(merge_spawn_pass)(void * arg)
         laux.parent = aux;
         laux.sz = 0;
         laux.temp = NULL;
+#if PMR_NUMA
+        laux.home = aux->home; /* stay at home node of chunk */
+#endif
 
         pass_ctx->effector(pass_ctx->lo, pass_ctx->mi, pass_ctx->hi, pass_ctx->ctx, &laux);
         if (laux.rc != 0)
@@ -293,14 +296,28 @@ void _(merge_spawn_pass)(void * arg)
 #endif
     }
 
-    PMR_FREE(arg); /* clean self */
+    _slab_free(pass_ctx->ctx->slab, pass_ctx); /* clean self */
 }
 
 #if PMR_PARALLEL_USE_PTHREADS
 static void * _(merge_spawn_pass_ex)(void * arg)
 {
+    pmergesort_pass_context_t * pass_ctx = arg;
+    pmr_async_t * async = pass_ctx->ctx->async; /* the descriptor is released by the pass */
+
+#if PMR_NUMA
+    numa_scope_t scope;
+    (void)_numa_enter(&scope, pass_ctx->lo, pass_ctx->hi - pass_ctx->lo);
+#endif
+
     _(merge_spawn_pass)(arg);
 
+#if PMR_NUMA
+    _numa_leave(&scope);
+#endif
+
+    _async_release(async);
+
     return NULL;
 }
 #endif
@@ -376,9 +393,9 @@ static void _(inplace_symmerge)(void * lo, void * mi, void * hi, context_t * ctx
         {
 #if _PMR_PARALLEL_MAY_SPAWN
 #if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS
-            if (ctx->thpool != NULL && len > ctx->cut_off)
+            pmergesort_pass_context_t * pass_ctx;
+            if (ctx->thpool != NULL && len > ctx->cut_off && (pass_ctx = _slab_alloc(ctx->slab)) != NULL)
             {
-                pmergesort_pass_context_t * pass_ctx = PMR_MALLOC(sizeof(pmergesort_pass_context_t));
                 pass_ctx->ctx = ctx;
                 pass_ctx->bsz = 0;
                 pass_ctx->dbl_bsz = 0;
@@ -391,7 +408,10 @@ static void _(inplace_symmerge)(void * lo, void * mi, void * hi, context_t * ctx
                 pass_ctx->auxes = aux->parent;
 
 #if PMR_PARALLEL_USE_PTHREADS
-                thr_pool_queue(ctx->thpool, _(merge_spawn_pass_ex), pass_ctx);
+                _async_hold(ctx->async);
+
+                if (thr_pool_queue(ctx->thpool, _(merge_spawn_pass_ex), pass_ctx) != 0)
+                    _(merge_spawn_pass_ex)(pass_ctx); /* failed to queue, do it in place */
 #elif PMR_PARALLEL_USE_GCD
                 dispatch_group_async_f(ctx->thpool->group, ctx->thpool->queue, pass_ctx, _(merge_spawn_pass));
 #endif
@@ -399,8 +419,14 @@ static void _(inplace_symmerge)(void * lo, void * mi, void * hi, context_t * ctx
             else
                 _(inplace_symmerge)(lo, start, mid, ctx, aux);
 #elif PMR_PARALLEL_USE_OMP
-            #pragma omp task if (len > ctx->cut_off) default(none) firstprivate(lo, start, mid, ctx)
-            _(inplace_symmerge)(lo, start, mid, ctx, NULL);
+            if (ctx->thpool != NULL && len > ctx->cut_off && !omp_in_final())
+            {
+                /* the task merges len / 2 elements, so below 2 * cut_off nothing is worth of spawn inside of it */
+                #pragma omp task default(none) firstprivate(lo, start, mid, ctx) final(len <= 2 * ctx->cut_off)
+                _(inplace_symmerge)(lo, start, mid, ctx, NULL);
+            }
+            else
+                _(inplace_symmerge)(lo, start, mid, ctx, aux);
 #endif /* PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS */
 #else
             _(inplace_symmerge)(lo, start, mid, ctx, NULL);
@@ -496,9 +522,9 @@ static __attribute__((unused)) void _(aux_symmerge)(void * lo, void * mi, void *
         {
 #if _PMR_PARALLEL_MAY_SPAWN
 #if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS
-            if (ctx->thpool != NULL && len > ctx->cut_off)
+            pmergesort_pass_context_t * pass_ctx;
+            if (ctx->thpool != NULL && len > ctx->cut_off && (pass_ctx = _slab_alloc(ctx->slab)) != NULL)
             {
-                pmergesort_pass_context_t * pass_ctx = PMR_MALLOC(sizeof(pmergesort_pass_context_t));
                 pass_ctx->ctx = ctx;
                 pass_ctx->bsz = 0;
                 pass_ctx->dbl_bsz = 0;
@@ -511,7 +537,10 @@ static __attribute__((unused)) void _(aux_symmerge)(void * lo, void * mi, void *
                 pass_ctx->auxes = aux->parent;
 
 #if PMR_PARALLEL_USE_PTHREADS
-                thr_pool_queue(ctx->thpool, _(merge_spawn_pass_ex), pass_ctx);
+                _async_hold(ctx->async);
+
+                if (thr_pool_queue(ctx->thpool, _(merge_spawn_pass_ex), pass_ctx) != 0)
+                    _(merge_spawn_pass_ex)(pass_ctx); /* failed to queue, do it in place */
 #elif PMR_PARALLEL_USE_GCD
                 dispatch_group_async_f(ctx->thpool->group, ctx->thpool->queue, pass_ctx, _(merge_spawn_pass));
 #endif
@@ -524,20 +553,32 @@ static __attribute__((unused)) void _(aux_symmerge)(void * lo, void * mi, void *
                     break; /* bail out */
             }
 #elif PMR_PARALLEL_USE_OMP
-            #pragma omp task if (len > ctx->cut_off) default(none) firstprivate(lo, start, mid, ctx, paux)
-            if (paux->rc == 0)
+            if (ctx->thpool != NULL && len > ctx->cut_off && !omp_in_final())
             {
-                aux_t laux;
-                laux.rc = 0;
-                laux.parent = paux;
-                laux.sz = 0;
-                laux.temp = NULL;
-
-                _(aux_symmerge)(lo, start, mid, ctx, &laux);
-                if (laux.rc != 0)
-                    paux->rc = laux.rc; /* FIXME: atomic */
+                /* the task merges len / 2 elements, so below 2 * cut_off nothing is worth of spawn inside of it */
+                #pragma omp task default(none) firstprivate(lo, start, mid, ctx, paux, len) final(len <= 2 * ctx->cut_off)
+                if (paux->rc == 0 && !_cancelled(ctx, paux))
+                {
+                    /* own temporary storage, the spawning task may be suspended on this thread with its one in use */
+                    aux_t laux;
+                    laux.rc = 0;
+                    laux.parent = paux;
+                    laux.sz = 0;
+                    laux.temp = NULL;
+
+                    _(aux_symmerge)(lo, start, mid, ctx, &laux);
+                    if (laux.rc != 0)
+                        (void)__sync_bool_compare_and_swap(&paux->rc, 0, laux.rc);
+
+                    _aux_free(&laux);
+                }
+            }
+            else
+            {
+                _(aux_symmerge)(lo, start, mid, ctx, aux);
 
-                _aux_free(&laux);
+                if (aux->rc != 0)
+                    break; /* bail out */
             }
 #endif /* PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS */
 #else
@@ -879,9 +920,9 @@ static inline void _(binsort_run)(void * lo, __unused void * mi, void * hi, cont
 /*  binary insertion sort of segment with finding the longest presorted runs to submerge                                      */
 /*  [lo, hi) => [lo, hi)                                                                                                      */
 /* -------------------------------------------------------------------------------------------------------------------------- */
-static inline void _(binsort_mergerun)(void * lo, __unused void * mi, void * hi, context_t * ctx, __unused aux_t * aux)
+static inline void _(submerge_runs)(void * lo, void * end, void * hi, context_t * ctx)
 {
-    void * end = ELT_PTR_NEXT(ctx, _(next_run)(lo, hi, ctx));
+    end = ELT_PTR_NEXT(ctx, end);
     while (end < hi)
     {
         void * end0 = ELT_PTR_NEXT(ctx, _(next_run)(end, hi, ctx));
@@ -895,10 +936,33 @@ static inline void _(binsort_mergerun)(void * lo, __unused void * mi, void * hi,
     }
 }
 
+static inline void _(binsort_mergerun)(void * lo, __unused void * mi, void * hi, context_t * ctx, __unused aux_t * aux)
+{
+    _(submerge_runs)(lo, _(next_run)(lo, hi, ctx), hi, ctx);
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  adaptive pre-sort of segment: the longest presorted run at start tells the local order, long one (a quarter of segment    */
+/*  at least) makes the rest submerged by runs, short one makes the rest sorted by binary insertion after the run (as         */
+/*  binsort_run does), so the elements of the run already compared by next_run are not inserted again                         */
+/*  [lo, hi) => [lo, hi)                                                                                                      */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+static inline void _(binsort_adaptive)(void * lo, __unused void * mi, void * hi, context_t * ctx, __unused aux_t * aux)
+{
+    void * end = _(next_run)(lo, hi, ctx);
+    if (end >= hi)
+        return;
+
+    if ((ELT_DIST(ctx, end, lo) + 1) << 2 >= ELT_DIST(ctx, hi, lo))
+        _(submerge_runs)(lo, end, hi, ctx);
+    else
+        _(binsort)(lo, end, hi, ctx, NULL);
+}
+
 /* -------------------------------------------------------------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------------------------------------------------------- */
 
-#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS || PMR_PARALLEL_USE_OMP
 /* -------------------------------------------------------------------------------------------------------------------------- */
 /*  unified core of parallel mergesort                                                                                        */
 /* -------------------------------------------------------------------------------------------------------------------------- */
@@ -909,7 +973,11 @@ inline
 void _(sort_chunk_pass)(void * arg, size_t chunk)
 {
     pmergesort_pass_context_t * pass_ctx = arg;
+#if PMR_PARALLEL_USE_OMP
+    aux_t * aux = &pass_ctx->auxes[omp_get_thread_num()]; /* tied task runs to the end by the same thread */
+#else
     aux_t * aux = &pass_ctx->auxes[chunk];
+#endif
 
     int last = (chunk < pass_ctx->numchunks - 1) ? 0 : 1;
 
@@ -919,6 +987,9 @@ void _(sort_chunk_pass)(void * arg, size_t chunk)
 
     while (b <= c)
     {
+        if (_cancelled(pass_ctx->ctx, aux))
+            break;
+
         pass_ctx->effector(a, a, b, pass_ctx->ctx, aux);
         if (aux->rc != 0)
             break;
@@ -927,7 +998,7 @@ void _(sort_chunk_pass)(void * arg, size_t chunk)
         b = ELT_PTR_FWD(pass_ctx->ctx, b, pass_ctx->bsz);
     }
 
-    if (last != 0 && aux->rc == 0)
+    if (last != 0 && aux->rc == 0 && !_cancelled(pass_ctx->ctx, aux))
         pass_ctx->effector(a, a, c, pass_ctx->ctx, aux);
 }
 
@@ -943,7 +1014,11 @@ void _(merge_chunks_pass)(void * arg, size_t chunk)
     dispatch_semaphore_wait(pass_ctx->ctx->thpool->mutex, DISPATCH_TIME_FOREVER); /* semaphore to prevent the threads overcommit flood */
 #endif
 
+#if PMR_PARALLEL_USE_OMP
+    aux_t * aux = &pass_ctx->auxes[omp_get_thread_num()]; /* tied task runs to the end by the same thread */
+#else
     aux_t * aux = &pass_ctx->auxes[chunk];
+#endif
 
     int last = (chunk < pass_ctx->numchunks - 1) ? 0 : 1;
 
@@ -953,6 +1028,9 @@ void _(merge_chunks_pass)(void * arg, size_t chunk)
 
     while (b <= c)
     {
+        if (_cancelled(pass_ctx->ctx, aux))
+            break;
+
         pass_ctx->effector(a, ELT_PTR_FWD(pass_ctx->ctx, a, pass_ctx->bsz), b, pass_ctx->ctx, aux);
         if (aux->rc != 0)
             break;
@@ -961,7 +1039,7 @@ void _(merge_chunks_pass)(void * arg, size_t chunk)
         b = ELT_PTR_FWD(pass_ctx->ctx, b, pass_ctx->dbl_bsz);
     }
 
-    if (last != 0 && aux->rc == 0)
+    if (last != 0 && aux->rc == 0 && !_cancelled(pass_ctx->ctx, aux))
         pass_ctx->effector(a, ELT_PTR_FWD(pass_ctx->ctx, a, pass_ctx->bsz), c, pass_ctx->ctx, aux);
 
 #if PMR_PARALLEL_USE_GCD && _PMR_PARALLEL_MAY_SPAWN && !_PMR_GCD_OVERCOMMIT
@@ -970,17 +1048,52 @@ void _(merge_chunks_pass)(void * arg, size_t chunk)
 }
 
 #if PMR_PARALLEL_USE_PTHREADS
+#if PMR_NUMA
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  bind the worker to the home node of chunk and keep temporary storage of chunk there                                      */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+static inline void _(chunk_pass_enter)(pmergesort_pass_context_t * pass_ctx, numa_scope_t * scope)
+{
+    size_t chunk = pass_ctx->chunk;
+
+    void * a = ELT_PTR_FWD(pass_ctx->ctx, pass_ctx->lo, pass_ctx->chunksz * chunk);
+    void * c = chunk < pass_ctx->numchunks - 1 ? ELT_PTR_FWD(pass_ctx->ctx, a, pass_ctx->chunksz) : pass_ctx->hi;
+
+    int node = _numa_enter(scope, a, c - a);
+
+    _aux_rehome(&pass_ctx->auxes[chunk], node);
+}
+#endif
+
 static void * _(sort_chunk_pass_ex)(void * arg)
 {
+#if PMR_NUMA
+    numa_scope_t scope;
+    _(chunk_pass_enter)(arg, &scope);
+#endif
+
     _(sort_chunk_pass)(arg, ((pmergesort_pass_context_t *)arg)->chunk);
 
+#if PMR_NUMA
+    _numa_leave(&scope);
+#endif
+
     return NULL;
 }
 
 static void * _(merge_chunks_pass_ex)(void * arg)
 {
+#if PMR_NUMA
+    numa_scope_t scope;
+    _(chunk_pass_enter)(arg, &scope);
+#endif
+
     _(merge_chunks_pass)(arg, ((pmergesort_pass_context_t *)arg)->chunk);
 
+#if PMR_NUMA
+    _numa_leave(&scope);
+#endif
+
     return NULL;
 }
 
@@ -989,6 +1102,13 @@ static void * _(merge_chunks_pass_ex)(void * arg)
 /* -------------------------------------------------------------------------------------------------------------------------- */
 static inline int _(pmergesort_impl)(context_t * ctx)
 {
+#if _PMR_PARALLEL_MAY_SPAWN
+    slab_t slab;
+    _slab_init(&slab);
+
+    ctx->slab = &slab;
+#endif
+
     aux_t auxes[ctx->ncpu];
     for (int i = 0; i < ctx->ncpu; i++)
         auxes[i] = (aux_t){ .parent = &auxes[i] };
@@ -1106,6 +1226,11 @@ static inline int _(pmergesort_impl)(context_t * ctx)
 
 bail_out:;
 
+#if _PMR_PARALLEL_MAY_SPAWN
+    ctx->slab = NULL;
+    _slab_destroy(&slab);
+#endif
+
     int rc = 0;
     for (int i = 0; i < ctx->ncpu; i++)
     {
@@ -1136,6 +1261,13 @@ static inline int _(pmergesort_impl)(context_t * ctx)
 
     ctx->thpool = &pool;
 
+#if _PMR_PARALLEL_MAY_SPAWN
+    slab_t slab;
+    _slab_init(&slab);
+
+    ctx->slab = &slab;
+#endif
+
     aux_t auxes[ctx->ncpu];
     for (int i = 0; i < ctx->ncpu; i++)
         auxes[i] = (aux_t){ .parent = &auxes[i] };
@@ -1250,6 +1382,9 @@ bail_out:;
     if (pool.mutex != NULL)
         dispatch_release(DISPATCH_OBJECT_T(pool.mutex));
 #endif
+
+    ctx->slab = NULL;
+    _slab_destroy(&slab);
 #endif
 
     int rc = 0;
@@ -1263,17 +1398,12 @@ bail_out:;
 
     return rc;
 }
-#endif
 #elif PMR_PARALLEL_USE_OMP
 /* -------------------------------------------------------------------------------------------------------------------------- */
-/*  unified core of parallel mergesort based on OpenMP                                                                        */
+/*  passes of parallel mergesort as OpenMP tasks, a taskgroup per level waits for chunks and symmerge tasks spawned by them    */
 /* -------------------------------------------------------------------------------------------------------------------------- */
-static inline int _(pmergesort_impl)(context_t * ctx)
+static inline void _(pmergesort_tasks)(context_t * ctx, aux_t * auxes, int naux)
 {
-    aux_t auxes[ctx->ncpu];
-    for (int i = 0; i < ctx->ncpu; i++)
-        auxes[i] = (aux_t){ .parent = &auxes[i] };
-
     void * lo = (void *)ctx->base;
     void * hi = ELT_PTR_FWD(ctx, lo, ctx->n);
 
@@ -1286,43 +1416,42 @@ static inline int _(pmergesort_impl)(context_t * ctx)
         size_t chunksz = IDIV_UP(npercpu, bsz) * bsz;
         size_t numchunks = IDIV_UP(ctx->n, chunksz);
 
-        #pragma omp parallel num_threads(numchunks)
-        #pragma omp for
-        for (size_t chunk = 0; chunk < numchunks; chunk++)
-        {
-            aux_t * aux = &auxes[chunk];
-
-            int last = (chunk < numchunks - 1) ? 0 : 1;
-
-            void * a = ELT_PTR_FWD(ctx, lo, chunksz * chunk);
-            void * b = ELT_PTR_FWD(ctx, a, bsz);
-            void * c = last == 0 ? ELT_PTR_FWD(ctx, a, chunksz) : hi;
+        pmergesort_pass_context_t pass1_ctx;
+        pass1_ctx.ctx = ctx;
+        pass1_ctx.bsz = bsz;
+        pass1_ctx.chunksz = chunksz;
+        pass1_ctx.numchunks = numchunks;
+        pass1_ctx.lo = lo;
+        pass1_ctx.mi = NULL;
+        pass1_ctx.hi = hi;
+        pass1_ctx.effector = ctx->sort_effector;
+        pass1_ctx.auxes = auxes;
 
-            while (b <= c)
+        #pragma omp taskgroup
+        {
+            for (size_t chunk = 0; chunk < numchunks; chunk++)
             {
-                ctx->sort_effector(a, a, b, ctx, aux);
-                if (aux->rc != 0)
-                    break;
-
-                a = b;
-                b = ELT_PTR_FWD(ctx, b, bsz);
+                #pragma omp task default(none) firstprivate(chunk) shared(pass1_ctx)
+                _(sort_chunk_pass)(&pass1_ctx, chunk);
             }
-
-            if (last != 0 && aux->rc == 0)
-                ctx->sort_effector(a, a, c, ctx, aux);
         }
 
-        for (int i = 0; i < numchunks; i++)
+        for (int i = 0; i < naux; i++)
         {
             if (auxes[i].rc != 0)
-                goto bail_out;
+                return;
         }
     }
 
     /* pass 2 */
     {
-        /* num. threads override */
-        __unused size_t ncpu = ctx->thpool != NULL ? ctx->thpool->ncpu : 0;
+        pmergesort_pass_context_t pass2_ctx;
+        pass2_ctx.ctx = ctx;
+        pass2_ctx.lo = lo;
+        pass2_ctx.mi = NULL;
+        pass2_ctx.hi = hi;
+        pass2_ctx.effector = ctx->merge_effector;
+        pass2_ctx.auxes = auxes;
 
         while (bsz < ctx->n)
         {
@@ -1332,48 +1461,64 @@ static inline int _(pmergesort_impl)(context_t * ctx)
             size_t chunksz = IDIV_UP(npercpu, dbl_bsz) * dbl_bsz;
             size_t numchunks = IDIV_UP(ctx->n, chunksz);
 
-            #pragma omp parallel num_threads(ncpu != 0 ? ncpu : numchunks)
-            #pragma omp for
-            for (size_t chunk = 0; chunk < numchunks; chunk++)
-            {
-                aux_t * aux = &auxes[chunk];
-
-                int last = (chunk < numchunks - 1) ? 0 : 1;
-
-                void * a = ELT_PTR_FWD(ctx, lo, chunksz * chunk);
-                void * b = ELT_PTR_FWD(ctx, a, dbl_bsz);
-                void * c = last == 0 ? ELT_PTR_FWD(ctx, a, chunksz) : hi;
+            pass2_ctx.bsz = bsz;
+            pass2_ctx.dbl_bsz = dbl_bsz;
+            pass2_ctx.chunksz = chunksz;
+            pass2_ctx.numchunks = numchunks;
 
-                while (b <= c)
+            #pragma omp taskgroup
+            {
+                for (size_t chunk = 0; chunk < numchunks; chunk++)
                 {
-                    ctx->merge_effector(a, ELT_PTR_FWD(ctx, a, bsz), b, ctx, aux);
-                    if (aux->rc != 0)
-                        break;
-
-                    a = b;
-                    b = ELT_PTR_FWD(ctx, b, dbl_bsz);
+                    #pragma omp task default(none) firstprivate(chunk) shared(pass2_ctx)
+                    _(merge_chunks_pass)(&pass2_ctx, chunk);
                 }
-
-                if (last != 0 && aux->rc == 0)
-                    ctx->merge_effector(a, ELT_PTR_FWD(ctx, a, bsz), c, ctx, aux);
             }
 
-            #pragma omp taskwait
-
-            for (int i = 0; i < numchunks; i++)
+            for (int i = 0; i < naux; i++)
             {
                 if (auxes[i].rc != 0)
-                    goto bail_out;
+                    return;
             }
 
             bsz = dbl_bsz;
         }
     }
+}
 
-bail_out:;
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  unified core of parallel mergesort based on OpenMP                                                                        */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+static inline int _(pmergesort_impl)(context_t * ctx)
+{
+    /* join the team of caller if any, else open the only parallel region for the whole sort */
+    int nested = omp_in_parallel();
+
+    thr_pool_t pool;
+    pool.ncpu = nested ? omp_get_num_threads() : ctx->ncpu;
+
+    ctx->thpool = &pool; /* enable spawn of symmerge tasks */
+
+    /* temporary storage per thread of team, tied tasks never migrate between threads */
+    int naux = (int)pool.ncpu;
+
+    aux_t auxes[naux];
+    for (int i = 0; i < naux; i++)
+        auxes[i] = (aux_t){ .parent = &auxes[i] };
+
+    if (nested)
+        _(pmergesort_tasks)(ctx, auxes, naux);
+    else
+    {
+        #pragma omp parallel num_threads(naux) default(none) shared(ctx, auxes, naux)
+        #pragma omp single
+        _(pmergesort_tasks)(ctx, auxes, naux);
+    }
+
+    ctx->thpool = NULL;
 
     int rc = 0;
-    for (int i = 0; i < ctx->ncpu; i++)
+    for (int i = 0; i < naux; i++)
     {
         _aux_free(&auxes[i]);
 
@@ -1383,7 +1528,59 @@ bail_out:;
 
     return rc;
 }
-#endif /* PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS */
+#endif
+#endif /* PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS || PMR_PARALLEL_USE_OMP */
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  time a sample of comparator calls, returns cost of call in ns                                                             */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+#if (PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS || PMR_PARALLEL_USE_OMP) && _PMR_CMP_PROBE
+static inline unsigned int _(cmp_cost)(context_t * ctx)
+{
+    void * lo = (void *)ctx->base;
+    size_t step = (ctx->n - 1) / _PMR_CMP_PROBES;
+
+    struct timespec t0, t1;
+    volatile int acc = 0;
+
+    /* the 1st round brings sampled elements to cache, the 2nd one is timed */
+    for (int round = 0; round < 2; round++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+
+        void * a = lo;
+        for (int i = 0; i < _PMR_CMP_PROBES; i++)
+        {
+            acc += CALL_CMP(ctx, a, ELT_PTR_NEXT(ctx, a));
+            a = ELT_PTR_FWD(ctx, a, step);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+    }
+
+    long long ns = (long long)(t1.tv_sec - t0.tv_sec) * 1000000000LL + (t1.tv_nsec - t0.tv_nsec);
+    ns /= _PMR_CMP_PROBES;
+
+    return ns > 0 ? (unsigned int)ns : 1;
+}
+#endif
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  tune thresholds of sort by the comparator cost (hinted or probed)                                                         */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+static inline void _(tune)(context_t * ctx)
+{
+    unsigned int cost = ctx->cost;
+
+#if (PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS || PMR_PARALLEL_USE_OMP) && _PMR_CMP_PROBE
+    if (cost == 0 && ctx->ncpu > 1)
+        cost = _(cmp_cost)(ctx);
+#endif
+
+    tuneCost(ctx, cost);
+}
 
 /* -------------------------------------------------------------------------------------------------------------------------- */
 
@@ -1391,7 +1588,7 @@ bail_out:;
 /*  in-place mergesort (symmerge based)                                                                                       */
 /* -------------------------------------------------------------------------------------------------------------------------- */
 
-static inline void _(symmergesort)(context_t * ctx)
+static inline int _(symmergesort)(context_t * ctx)
 {
     if (ctx->n < _PMR_BLOCKLEN_MTHRESHOLD0 * _PMR_BLOCKLEN_SYMMERGE)
     {
@@ -1400,11 +1597,13 @@ static inline void _(symmergesort)(context_t * ctx)
 
         _(_PMR_PRESORT)(lo, lo, hi, ctx, NULL);
 
-        return;
+        return 0;
     }
 
+    _(tune)(ctx);
+
 #if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS || PMR_PARALLEL_USE_OMP
-    for (int ncpu = ctx->ncpu; ncpu > 1; ncpu--)
+    for (int ncpu = scaleCPU(ctx->n, ctx->ncpu, ctx->grain); ncpu > 1; ncpu--)
     {
         size_t npercpu = IDIV_UP(ctx->n, ncpu);
         if (npercpu >= _PMR_BLOCKLEN_MTHRESHOLD * _PMR_BLOCKLEN_SYMMERGE)
@@ -1413,21 +1612,12 @@ static inline void _(symmergesort)(context_t * ctx)
 
             /* pre-set initial pass values */
             ctx->npercpu = npercpu;
-            ctx->bsize = _PMR_BLOCKLEN_SYMMERGE;
+            ctx->bsize = _PMR_BLOCKLEN_SYMMERGE << ctx->bshift;
             ctx->sort_effector = _(_PMR_PRESORT);
             ctx->merge_effector = _(inplace_symmerge);
 
-#if PMR_PARALLEL_USE_OMP && _PMR_PARALLEL_MAY_SPAWN
-            thr_pool_t pool;
-            pool.ncpu = ctx->ncpu; /* utilize maximum number of cores when symmerge spawns threads */
-
-            ctx->thpool = &pool;
-#endif
-
             /* run parallel sort */
-            (void)_(pmergesort_impl)(ctx);
-
-            return;
+            return _(pmergesort_impl)(ctx);
         }
     }
 #endif
@@ -1439,13 +1629,17 @@ static inline void _(symmergesort)(context_t * ctx)
     void * lo = (void *)ctx->base;
     void * hi = ELT_PTR_FWD(ctx, lo, ctx->n);
 
-    size_t bsz = _PMR_BLOCKLEN_SYMMERGE;
+    size_t bsz = _PMR_BLOCKLEN_SYMMERGE << ctx->bshift;
+    int rc;
 
     void * a = lo;
     void * b = ELT_PTR_FWD(ctx, a, bsz);
 
     while (b <= hi)
     {
+        if ((rc = _cancelled(ctx, NULL)) != 0)
+            return rc;
+
         _(_PMR_PRESORT)(a, a, b, ctx, NULL);
 
         a = b;
@@ -1463,6 +1657,9 @@ static inline void _(symmergesort)(context_t * ctx)
 
         while (b <= hi)
         {
+            if ((rc = _cancelled(ctx, NULL)) != 0)
+                return rc;
+
             _(inplace_symmerge)(a, ELT_PTR_FWD(ctx, a, bsz), b, ctx, NULL);
 
             a = b;
@@ -1473,6 +1670,8 @@ static inline void _(symmergesort)(context_t * ctx)
 
         bsz = bsz1;
     }
+
+    return 0;
 }
 
 /* -------------------------------------------------------------------------------------------------------------------------- */
@@ -1481,20 +1680,18 @@ static inline void _(symmergesort)(context_t * ctx)
 /*  naïve mergesort implementation                                                                                            */
 /* -------------------------------------------------------------------------------------------------------------------------- */
 
-static inline int _(pmergesort)(context_t * ctx)
+/*
+ * pre-set pass values of parallel sort, returns 0 if the sort is not worth of threads
+ */
+static inline int _(pmergesort_plan)(context_t * ctx)
 {
     if (ctx->n < _PMR_BLOCKLEN_MTHRESHOLD0 * _PMR_BLOCKLEN_SYMMERGE)
-    {
-        void * lo = (void *)ctx->base;
-        void * hi = ELT_PTR_FWD(ctx, lo, ctx->n);
-
-        _(_PMR_PRESORT)(lo, lo, hi, ctx, NULL);
-
         return 0;
-    }
+
+    _(tune)(ctx);
 
 #if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS || PMR_PARALLEL_USE_OMP
-    for (int ncpu = ctx->ncpu; ncpu > 1; ncpu--)
+    for (int ncpu = scaleCPU(ctx->n, ctx->ncpu, ctx->grain); ncpu > 1; ncpu--)
     {
         size_t npercpu = IDIV_UP(ctx->n, ncpu);
         if (npercpu >= _PMR_BLOCKLEN_MTHRESHOLD * _PMR_BLOCKLEN_MERGE)
@@ -1503,30 +1700,34 @@ static inline int _(pmergesort)(context_t * ctx)
 
             /* pre-set initial pass values */
             ctx->npercpu = npercpu;
-            ctx->bsize = _PMR_BLOCKLEN_MERGE;
+            ctx->bsize = _PMR_BLOCKLEN_MERGE << ctx->bshift;
             ctx->sort_effector = _(_PMR_PRESORT);
             ctx->merge_effector = _(aux_merge);
 
-            /* run parallel sort */
-            return _(pmergesort_impl)(ctx);
+            return 1;
         }
     }
 #endif
 
-#if (PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS) && _PMR_PARALLEL_MAY_SPAWN
-    ctx->thpool = NULL; /* disable threads spawn */
-#endif
-
-    void * lo = (void *)ctx->base;
-    void * hi = ELT_PTR_FWD(ctx, lo, ctx->n);
+    return 0;
+}
 
-    size_t bsz = _PMR_BLOCKLEN_MERGE;
+/*
+ * sequential mergesort of [lo, hi) with temporary storage of aux, returns result code of aux
+ */
+static int _(aux_sort)(void * lo, void * hi, context_t * ctx, aux_t * aux)
+{
+    size_t n = ELT_DIST(ctx, hi, lo);
+    size_t bsz = _PMR_BLOCKLEN_MERGE << ctx->bshift;
 
     void * a = lo;
     void * b = ELT_PTR_FWD(ctx, a, bsz);
 
     while (b <= hi)
     {
+        if (_cancelled(ctx, aux))
+            return aux->rc;
+
         _(_PMR_PRESORT)(a, a, b, ctx, NULL);
 
         a = b;
@@ -1535,10 +1736,7 @@ static inline int _(pmergesort)(context_t * ctx)
 
     _(_PMR_PRESORT)(a, a, hi, ctx, NULL);
 
-    aux_t aux;
-    memset(&aux, 0, sizeof(aux));
-
-    while (bsz < ctx->n)
+    while (bsz < n)
     {
         size_t bsz1 = bsz << 1;
 
@@ -1547,63 +1745,1597 @@ static inline int _(pmergesort)(context_t * ctx)
 
         while (b <= hi)
         {
-            _(aux_merge)(a, ELT_PTR_FWD(ctx, a, bsz), b, ctx, &aux);
-            if (aux.rc != 0)
-                goto bail_out;
+            if (_cancelled(ctx, aux))
+                return aux->rc;
+
+            _(aux_merge)(a, ELT_PTR_FWD(ctx, a, bsz), b, ctx, aux);
+            if (aux->rc != 0)
+                return aux->rc;
 
             a = b;
             b = ELT_PTR_FWD(ctx, b, bsz1);
         }
 
-        _(aux_merge)(a, ELT_PTR_FWD(ctx, a, bsz), hi, ctx, &aux);
-        if (aux.rc != 0)
-            goto bail_out;
+        _(aux_merge)(a, ELT_PTR_FWD(ctx, a, bsz), hi, ctx, aux);
+        if (aux->rc != 0)
+            return aux->rc;
 
         bsz = bsz1;
     }
 
-bail_out:;
+    return aux->rc;
+}
+
+static inline int _(pmergesort_serial)(context_t * ctx)
+{
+    void * lo = (void *)ctx->base;
+    void * hi = ELT_PTR_FWD(ctx, lo, ctx->n);
+
+    if (ctx->n < _PMR_BLOCKLEN_MTHRESHOLD0 * _PMR_BLOCKLEN_SYMMERGE)
+    {
+        _(_PMR_PRESORT)(lo, lo, hi, ctx, NULL);
+
+        return 0;
+    }
+
+    aux_t aux;
+    memset(&aux, 0, sizeof(aux));
+
+    (void)_(aux_sort)(lo, hi, ctx, &aux);
+
     _aux_free(&aux);
 
     return aux.rc;
 }
 
 /* -------------------------------------------------------------------------------------------------------------------------- */
-
-/* -------------------------------------------------------------------------------------------------------------------------- */
-/*  compound mergesort (symmerge based) with wrapped pre-sort function                                                        */
+/*  presortedness check: chunks are scanned in parallel for non-descending and strictly descending order, a chunk gives up    */
+/*  once it has found both broken and makes the rest give up too, then the bounds of chunks are checked; so random input      */
+/*  costs a few comparisons per chunk, and sorted or reversed input costs a single read pass                                  */
 /* -------------------------------------------------------------------------------------------------------------------------- */
-
-static __attribute__((unused)) void _(wrap_sort)(void * lo, __unused void * mi, void * hi, context_t * ctx, aux_t * aux)
+static __attribute__((unused)) void _(presorted_chunk)(void * arg, size_t i)
 {
-    aux->rc = CALL_SORT(ctx, lo, ELT_DIST(ctx, hi, lo)); /* FIXME: atomic */
-}
+    presorted_context_t * pctx = arg;
+    context_t * ctx = pctx->ctx;
 
-static inline int _(wrapmergesort)(context_t * ctx)
-{
-#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS || PMR_PARALLEL_USE_OMP
-    if (ctx->n >= 2 * _PMR_BLOCKLEN_MTHRESHOLD0 * _PMR_BLOCKLEN_SYMMERGE)
+    void * lo = ELT_PTR_FWD(ctx, ctx->base, i * pctx->chunksz);
+    void * hi = i + 1 < pctx->numchunks ? ELT_PTR_FWD(ctx, lo, pctx->chunksz) : ELT_PTR_FWD(ctx, ctx->base, ctx->n);
+
+    int asc = 1;
+    int desc = 1;
+
+    size_t k = 0;
+    for (void * p = lo, * q = ELT_PTR_NEXT(ctx, lo); q < hi; p = q, q = ELT_PTR_NEXT(ctx, q))
     {
-        for (int ncpu = ctx->ncpu; ncpu > 1; ncpu--)
-        {
-            size_t npercpu = IDIV_UP(ctx->n, ncpu);
-            if (npercpu >= 2 * _PMR_BLOCKLEN_MTHRESHOLD * _PMR_BLOCKLEN_SYMMERGE)
-            {
-                /* use parallel when have a long enough array could be distributed by cores */
+        int rc = CALL_CMP(ctx, p, q);
 
-                /* pre-set initial pass values */
+        asc &= rc <= 0;
+        desc &= rc > 0;
+
+        if (!(asc | desc) || ((++k & 1023) == 0 && __sync_fetch_and_add(&pctx->unordered, 0)))
+        {
+            (void)__sync_bool_compare_and_swap(&pctx->unordered, 0, 1);
+            return;
+        }
+    }
+
+    pctx->order[i] = asc | (desc << 1);
+}
+
+static __attribute__((unused)) void _(reverse_chunk)(void * arg, size_t i)
+{
+    presorted_context_t * pctx = arg;
+    context_t * ctx = pctx->ctx;
+
+    size_t half = ctx->n >> 1;
+    size_t k = half * i / pctx->numchunks;
+    size_t kk = half * (i + 1) / pctx->numchunks;
+
+    void * p = ELT_PTR_FWD(ctx, ctx->base, k);
+    void * q = ELT_PTR_FWD(ctx, ctx->base, ctx->n - 1 - k);
+
+    for (; k < kk; k++, p = ELT_PTR_NEXT(ctx, p), q = ELT_PTR_PREV(ctx, q))
+        _M(swap)(p, q, ELT_SZ(ctx));
+}
+
+/*
+ * returns 1 if the array is sorted, -1 if it was strictly descending and has been reversed, 0 otherwise
+ */
+static inline int _(presorted)(context_t * ctx)
+{
+    int numchunks = 1;
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS || PMR_PARALLEL_USE_OMP
+    numchunks = scaleCPU(ctx->n, ctx->ncpu, _PMR_PARALLEL_GRAIN);
+    if (numchunks < 1)
+        numchunks = 1;
+#endif
+
+    int order[numchunks];
+
+    presorted_context_t pctx = { ctx, ctx->n / numchunks, numchunks, order, 0 };
+
+    if (numchunks > 1)
+        pmergesort_apply(numchunks, _(presorted_chunk), &pctx);
+    else
+        _(presorted_chunk)(&pctx, 0);
+
+    if (pctx.unordered)
+        return 0;
+
+    int all = order[0];
+    for (int i = 1; i < numchunks && all != 0; i++)
+    {
+        void * lo = ELT_PTR_FWD(ctx, ctx->base, i * pctx.chunksz);
+
+        int rc = CALL_CMP(ctx, ELT_PTR_PREV(ctx, lo), lo);
+
+        all &= order[i] & ((rc <= 0) | ((rc > 0) << 1));
+    }
+
+    if (all & 1)
+        return 1;
+
+    if (all & 2)
+    {
+        if (numchunks > 1)
+            pmergesort_apply(numchunks, _(reverse_chunk), &pctx);
+        else
+            _(reverse_chunk)(&pctx, 0);
+
+        return -1;
+    }
+
+    return 0;
+}
+
+static inline int _(pmergesort)(context_t * ctx)
+{
+    /* the presort of blocks deals with the order of short arrays itself */
+    if (ctx->n >= _PMR_BLOCKLEN_MTHRESHOLD0 * _PMR_BLOCKLEN_SYMMERGE && _(presorted)(ctx) != 0)
+        return 0;
+
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS || PMR_PARALLEL_USE_OMP
+    if (_(pmergesort_plan)(ctx))
+        return _(pmergesort_impl)(ctx); /* run parallel sort */
+#else
+    (void)_(pmergesort_plan)(ctx);
+#endif
+
+#if (PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS) && _PMR_PARALLEL_MAY_SPAWN
+    ctx->thpool = NULL; /* disable threads spawn */
+#endif
+
+    return _(pmergesort_serial)(ctx);
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  stable partial mergesort: the least k elements in order at the front, the rest in unspecified order                       */
+/*                                                                                                                            */
+/*  every chunk collects candidates at its front: an element less than the k-th candidate is swapped in, and once 2k are      */
+/*  collected the newcomers are sorted and merged, the greater half is dropped; since most elements cost one comparison with  */
+/*  the k-th the scan is about O(n + k log k) for random input; the k-prefixes of chunks are merged in turn afterwards        */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+/*
+ * select the least k elements of [lo, hi) in order into [lo, lo + k), assume hi - lo >= 2k
+ */
+static inline int _(topk_select)(void * lo, void * hi, size_t k, context_t * ctx, aux_t * aux)
+{
+    void * mi = ELT_PTR_FWD(ctx, lo, k);        /* end of k candidates */
+    void * end = ELT_PTR_FWD(ctx, mi, k);       /* end of room for newcomers */
+
+    if (_(aux_sort)(lo, end, ctx, aux) != 0)
+        return aux->rc;
+
+    void * kth = ELT_PTR_PREV(ctx, mi);
+    void * c = mi;
+
+    for (void * p = end; p < hi; p = ELT_PTR_NEXT(ctx, p))
+    {
+        /* ties with k-th are later in order, so not the candidates */
+        if (CALL_CMP(ctx, p, kth) >= 0)
+            continue;
+
+        _M(swap)(c, p, ELT_SZ(ctx));
+
+        c = ELT_PTR_NEXT(ctx, c);
+        if (c == end)
+        {
+            if (_(aux_sort)(mi, end, ctx, aux) != 0)
+                return aux->rc;
+
+            _(aux_merge)(lo, mi, end, ctx, aux);
+            if (aux->rc != 0)
+                return aux->rc;
+
+            c = mi;
+        }
+    }
+
+    if (c != mi && _(aux_sort)(mi, c, ctx, aux) == 0)
+        _(aux_merge)(lo, mi, c, ctx, aux);
+
+    return aux->rc;
+}
+
+static void _(topk_chunk)(void * arg, size_t i)
+{
+    topk_context_t * topk_ctx = arg;
+    context_t * ctx = topk_ctx->ctx;
+
+    void * lo = ELT_PTR_FWD(ctx, ctx->base, i * topk_ctx->chunksz);
+    void * hi = i + 1 < topk_ctx->numchunks ? ELT_PTR_FWD(ctx, lo, topk_ctx->chunksz) : ELT_PTR_FWD(ctx, ctx->base, ctx->n);
+
+    (void)_(topk_select)(lo, hi, topk_ctx->k, ctx, &topk_ctx->auxes[i]);
+}
+
+static inline int _(pmergesort_topk)(context_t * ctx, size_t k)
+{
+    /* selection does not pay off for large k */
+    if (k > ctx->n / 4)
+        return _(pmergesort)(ctx);
+
+    _(tune)(ctx);
+
+    int numchunks = 1;
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS || PMR_PARALLEL_USE_OMP
+    numchunks = scaleCPU(ctx->n, ctx->ncpu, ctx->grain);
+    while (numchunks > 1 && ctx->n / numchunks < 2 * k)
+        numchunks--;
+    if (numchunks < 1)
+        numchunks = 1;
+#endif
+
+    aux_t auxes[numchunks];
+    for (int i = 0; i < numchunks; i++)
+        auxes[i] = (aux_t){ .parent = &auxes[i] };
+
+    topk_context_t topk_ctx = { ctx, k, ctx->n / numchunks, numchunks, auxes };
+
+    /* pass 1: select candidates of chunks */
+    if (numchunks > 1)
+        pmergesort_apply(numchunks, _(topk_chunk), &topk_ctx);
+    else
+        _(topk_chunk)(&topk_ctx, 0);
+
+    int rc = 0;
+    for (int i = 0; i < numchunks; i++)
+    {
+        if (auxes[i].rc != 0)
+        {
+            rc = auxes[i].rc;
+            break;
+        }
+    }
+
+    /* pass 2: merge k-prefixes of chunks into the front, the room after the front takes the next prefix in turn */
+    void * lo = (void *)ctx->base;
+    void * mi = ELT_PTR_FWD(ctx, lo, k);
+    void * hi = ELT_PTR_FWD(ctx, mi, k);
+
+    for (int i = 1; i < numchunks && rc == 0; i++)
+    {
+        _M(swap_r)(mi, ELT_PTR_FWD(ctx, lo, i * topk_ctx.chunksz), k, ELT_SZ(ctx));
+
+        _(aux_merge)(lo, mi, hi, ctx, &auxes[0]);
+        rc = auxes[0].rc;
+    }
+
+    for (int i = 0; i < numchunks; i++)
+        _aux_free(&auxes[i]);
+
+    return rc;
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  selection of elements of given ranks (nth element, quantiles), not stable                                                 */
+/*                                                                                                                            */
+/*  quickselect with pivot picked at the rank of target from sorted random sample; long segments are partitioned in parallel */
+/*  as chunks, then elements misplaced across the split point are swapped by equal shares of workers; the work is O(n) for    */
+/*  a single rank and O(n log q) for q ranks                                                                                  */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+/*
+ * partition [lo, hi) by pivot, returns split point: the elements less than pivot (or equal to as well if le) go left
+ */
+static inline void * _(partition)(void * lo, void * hi, select_context_t * sel)
+{
+    context_t * ctx = sel->ctx;
+    void * pivot = sel->pivot;
+    int le = sel->le;
+
+    for (;;)
+    {
+        while (lo < hi && CALL_CMP(ctx, lo, pivot) < le)
+            lo = ELT_PTR_NEXT(ctx, lo);
+
+        while (lo < hi && CALL_CMP(ctx, ELT_PTR_PREV(ctx, hi), pivot) >= le)
+            hi = ELT_PTR_PREV(ctx, hi);
+
+        if (lo == hi)
+            return lo;
+
+        hi = ELT_PTR_PREV(ctx, hi);
+
+        _M(swap)(lo, hi, ELT_SZ(ctx));
+
+        lo = ELT_PTR_NEXT(ctx, lo);
+    }
+}
+
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS || PMR_PARALLEL_USE_OMP
+static void _(select_chunk)(void * arg, size_t i)
+{
+    select_context_t * sel = arg;
+
+    void * lo = ELT_PTR_FWD(sel->ctx, sel->lo, i * sel->chunksz);
+    void * hi = i + 1 < sel->numchunks ? ELT_PTR_FWD(sel->ctx, lo, sel->chunksz) : sel->hi;
+
+    sel->mids[i] = _(partition)(lo, hi, sel);
+}
+
+/*
+ * locate element of rank r in the list of segments
+ */
+static inline void * _(select_seek)(select_segment_t * segs, size_t r, size_t * inx, __unused context_t * ctx)
+{
+    size_t i = 0;
+    for (size_t len; r >= (len = ELT_DIST(ctx, segs[i].hi, segs[i].lo)); i++)
+        r -= len;
+
+    *inx = i;
+
+    return ELT_PTR_FWD(ctx, segs[i].lo, r);
+}
+
+static void _(select_fixup)(void * arg, size_t j)
+{
+    select_context_t * sel = arg;
+    context_t * ctx = sel->ctx;
+
+    size_t r = sel->nmisplaced * j / sel->nshares;
+    size_t r1 = sel->nmisplaced * (j + 1) / sel->nshares;
+    if (r == r1)
+        return;
+
+    size_t li, ri;
+    void * lp = _(select_seek)(sel->lsegs, r, &li, ctx);
+    void * rp = _(select_seek)(sel->rsegs, r, &ri, ctx);
+
+    while (r < r1)
+    {
+        size_t n = r1 - r;
+
+        size_t ln = ELT_DIST(ctx, sel->lsegs[li].hi, lp);
+        if (n > ln)
+            n = ln;
+
+        size_t rn = ELT_DIST(ctx, sel->rsegs[ri].hi, rp);
+        if (n > rn)
+            n = rn;
+
+        _M(swap_r)(lp, rp, n, ELT_SZ(ctx));
+
+        r += n;
+
+        lp = ELT_PTR_FWD(ctx, lp, n);
+        if (lp == sel->lsegs[li].hi && r < r1)
+            lp = sel->lsegs[++li].lo;
+
+        rp = ELT_PTR_FWD(ctx, rp, n);
+        if (rp == sel->rsegs[ri].hi && r < r1)
+            rp = sel->rsegs[++ri].lo;
+    }
+}
+#endif
+
+static inline void * _(select_partition)(void * lo, void * hi, select_context_t * sel)
+{
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS || PMR_PARALLEL_USE_OMP
+    context_t * ctx = sel->ctx;
+
+    int numchunks = scaleCPU(ELT_DIST(ctx, hi, lo), ctx->ncpu, ctx->grain);
+    if (numchunks > 1)
+    {
+        void * mids[numchunks];
+        select_segment_t lsegs[numchunks];
+        select_segment_t rsegs[numchunks];
+
+        sel->lo = lo;
+        sel->hi = hi;
+        sel->chunksz = ELT_DIST(ctx, hi, lo) / numchunks;
+        sel->numchunks = numchunks;
+        sel->mids = mids;
+
+        /* pass 1: partition chunks */
+        pmergesort_apply(numchunks, _(select_chunk), sel);
+
+        void * mi = lo;
+        for (int i = 0; i < numchunks; i++)
+            mi = ELT_PTR_FWD(ctx, mi, ELT_DIST(ctx, mids[i], ELT_PTR_FWD(ctx, lo, i * sel->chunksz)));
+
+        /* pass 2: swap right elements before split point with left elements after it */
+        size_t nmisplaced = 0;
+        size_t nl = 0;
+        size_t nr = 0;
+        for (int i = 0; i < numchunks; i++)
+        {
+            void * a = ELT_PTR_FWD(ctx, lo, i * sel->chunksz);
+            void * b = i + 1 < numchunks ? ELT_PTR_FWD(ctx, a, sel->chunksz) : hi;
+
+            if (mids[i] < mi)
+            {
+                lsegs[nl] = (select_segment_t){ mids[i], b < mi ? b : mi };
+                nmisplaced += ELT_DIST(ctx, lsegs[nl].hi, lsegs[nl].lo);
+                nl++;
+            }
+
+            if (mi < mids[i])
+                rsegs[nr++] = (select_segment_t){ a > mi ? a : mi, mids[i] };
+        }
+
+        if (nmisplaced != 0)
+        {
+            sel->nmisplaced = nmisplaced;
+            sel->nshares = nmisplaced >= ctx->grain ? numchunks : 1;
+            sel->lsegs = lsegs;
+            sel->rsegs = rsegs;
+
+            if (sel->nshares > 1)
+                pmergesort_apply(sel->nshares, _(select_fixup), sel);
+            else
+                _(select_fixup)(sel, 0);
+        }
+
+        return mi;
+    }
+#endif
+
+    return _(partition)(lo, hi, sel);
+}
+
+/*
+ * put elements of ranks ks[0 .. nks) (ascending, relative to base of array) of segment [lo, lo + n) of rank ilo in place
+ */
+static int _(select)(void * lo, size_t ilo, size_t n, const size_t * ks, size_t nks, select_context_t * sel, aux_t * aux)
+{
+    context_t * ctx = sel->ctx;
+
+    while (nks != 0)
+    {
+        if (n <= _PMR_SELECT_SMALL)
+            return _(aux_sort)(lo, ELT_PTR_FWD(ctx, lo, n), ctx, aux);
+
+        /* random sample at the front, sorted */
+        size_t ns = n / _PMR_SELECT_SMALL;
+        if (ns > _PMR_SELECT_SAMPLES)
+            ns = _PMR_SELECT_SAMPLES;
+
+        for (size_t i = 0; i < ns; i++)
+        {
+            sel->seed ^= sel->seed << 13;
+            sel->seed ^= sel->seed >> 7;
+            sel->seed ^= sel->seed << 17;
+
+            _M(swap)(ELT_PTR_FWD(ctx, lo, i), ELT_PTR_FWD(ctx, lo, i + sel->seed % (n - i)), ELT_SZ(ctx));
+        }
+
+        if (_(aux_sort)(lo, ELT_PTR_FWD(ctx, lo, ns), ctx, aux) != 0)
+            return aux->rc;
+
+        /* pivot at the rank of median target */
+        _M(copy)(ELT_PTR_FWD(ctx, lo, (ks[nks >> 1] - ilo) * ns / n), sel->pivot, 1, ELT_SZ(ctx));
+
+        sel->le = 0;
+        void * mi = _(select_partition)(lo, ELT_PTR_FWD(ctx, lo, n), sel);
+        size_t nl = ELT_DIST(ctx, mi, lo);
+
+        if (nl == 0)
+        {
+            /* pivot is the least, split the run of its equals off */
+            sel->le = 1;
+            mi = _(select_partition)(lo, ELT_PTR_FWD(ctx, lo, n), sel);
+            nl = ELT_DIST(ctx, mi, lo);
+
+            while (nks != 0 && ks[0] < ilo + nl)
+            {
+                ks++;
+                nks--;
+            }
+
+            lo = mi;
+            ilo += nl;
+            n -= nl;
+
+            continue;
+        }
+
+        size_t nksl = 0;
+        while (nksl < nks && ks[nksl] < ilo + nl)
+            nksl++;
+
+        if (nksl == nks)
+        {
+            n = nl;
+
+            continue;
+        }
+
+        if (nksl != 0 && _(select)(lo, ilo, nl, ks, nksl, sel, aux) != 0)
+            return aux->rc;
+
+        ks += nksl;
+        nks -= nksl;
+
+        lo = mi;
+        ilo += nl;
+        n -= nl;
+    }
+
+    return 0;
+}
+
+static inline int _(pmr_select)(context_t * ctx, const size_t * ks, size_t nks)
+{
+    _(tune)(ctx);
+
+    aux_t aux = { .parent = &aux };
+    aux_t paux = { .parent = &paux };
+
+    select_context_t sel;
+    memset(&sel, 0, sizeof(sel));
+
+    sel.ctx = ctx;
+    sel.seed = 0x9e3779b97f4a7c15ULL;
+    sel.pivot = _aux_alloc(&paux, ELT_SZ(ctx));
+
+    int rc = paux.rc;
+    if (rc == 0)
+        rc = _(select)((void *)ctx->base, 0, ctx->n, ks, nks, &sel, &aux);
+
+    _aux_free(&aux);
+    _aux_free(&paux);
+
+    return rc;
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  merge of pre-sorted runs                                                                                                  */
+/*                                                                                                                            */
+/*  in place: adjacent runs are merged by pairs level by level, the merges of level run in parallel; while there are less    */
+/*  merges than workers every merge is split in halves at the middle of its output (the side-changing elements are rotated), */
+/*  so the top levels are parallel as well                                                                                    */
+/*                                                                                                                            */
+/*  k-way: the output is split into ranges by the splitters taken from sorted sample of runs, every range is merged by its    */
+/*  worker with loser tree in one pass                                                                                        */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+/*
+ * number of elements of [a, a + la) among the first t ones of stable merge with [b, b + lb)
+ */
+static inline size_t _(corank)(size_t t, void * a, size_t la, void * b, size_t lb, context_t * ctx)
+{
+    size_t lo = t > lb ? t - lb : 0;
+    size_t hi = t < la ? t : la;
+
+    while (lo < hi)
+    {
+        size_t i = (lo + hi) >> 1;
+
+        /* a[i] goes before b[t - i - 1], so more of a are in */
+        if (CALL_CMP(ctx, ELT_PTR_FWD(ctx, a, i), ELT_PTR_FWD(ctx, b, t - i - 1)) <= 0)
+            lo = i + 1;
+        else
+            hi = i;
+    }
+
+    return lo;
+}
+
+static void _(merge_half)(void * arg, size_t i)
+{
+    merge_runs_context_t * mctx = arg;
+    context_t * ctx = mctx->ctx;
+
+    merge_task_t task = mctx->tasks[i];
+    merge_task_t * halves = &mctx->halves[i << 1];
+
+    size_t la = ELT_DIST(ctx, task.mi, task.lo);
+    size_t lb = ELT_DIST(ctx, task.hi, task.mi);
+    if (la == 0 || lb == 0 || la + lb < mctx->grain << 1)
+    {
+        halves[0] = task;
+        halves[1] = (merge_task_t){ task.hi, task.hi, task.hi };
+        return;
+    }
+
+    size_t t = (la + lb) >> 1;
+    size_t ia = _(corank)(t, task.lo, la, task.mi, lb, ctx);
+
+    void * a = ELT_PTR_FWD(ctx, task.lo, ia);
+    void * b = ELT_PTR_FWD(ctx, task.mi, t - ia);
+
+    _M(rotate)(a, task.mi, b, ELT_SZ(ctx));
+
+    void * mi = ELT_PTR_FWD(ctx, task.lo, t);
+
+    halves[0] = (merge_task_t){ task.lo, a, mi };
+    halves[1] = (merge_task_t){ mi, ELT_PTR_FWD(ctx, mi, la - ia), task.hi };
+
+    (void)__sync_bool_compare_and_swap(&mctx->split, 0, 1);
+}
+
+static void _(merge_task)(void * arg, size_t i)
+{
+    merge_runs_context_t * mctx = arg;
+    merge_task_t * task = &mctx->tasks[i];
+
+    int rc = _cancelled(mctx->ctx, NULL);
+    if (rc != 0)
+    {
+        (void)__sync_bool_compare_and_swap(&mctx->rc, 0, rc);
+        return;
+    }
+
+    aux_t aux = { .parent = &aux };
+
+    if (!mctx->inplace)
+        _(aux_merge)(task->lo, task->mi, task->hi, mctx->ctx, &aux);
+
+    if (mctx->inplace || aux.rc != 0)
+    {
+        /* not enough memory, the segments are intact, merge them in place */
+        aux.rc = 0;
+
+        _(inplace_symmerge)(task->lo, task->mi, task->hi, mctx->ctx, &aux);
+    }
+
+    _aux_free(&aux);
+}
+
+static inline int _(merge_runs)(context_t * ctx, const size_t * offs, size_t nruns, int inplace)
+{
+    if (ctx->n < 2)
+        return 0;
+
+    _(tune)(ctx);
+
+    int nworkers = 1;
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS || PMR_PARALLEL_USE_OMP
+    nworkers = scaleCPU(ctx->n, ctx->ncpu, ctx->grain);
+    if (nworkers < 1)
+        nworkers = 1;
+#endif
+
+    size_t maxtasks = nruns >> 1;
+    if (maxtasks < (size_t)nworkers << 1)
+        maxtasks = (size_t)nworkers << 1;
+
+    void ** bounds = PMR_MALLOC(sizeof(void *) * (nruns + 1));
+    merge_task_t * tasks = PMR_MALLOC(sizeof(merge_task_t) * maxtasks * 2);
+    if (bounds == NULL || tasks == NULL)
+    {
+        PMR_FREE(bounds);
+        PMR_FREE(tasks);
+
+        return 1;
+    }
+
+    for (size_t r = 0; r <= nruns; r++)
+        bounds[r] = ELT_PTR_FWD(ctx, ctx->base, offs[r] - offs[0]);
+
+    merge_runs_context_t mctx;
+    memset(&mctx, 0, sizeof(mctx));
+
+    mctx.ctx = ctx;
+    mctx.grain = ctx->grain;
+    mctx.inplace = inplace;
+
+    while (nruns > 1 && mctx.rc == 0)
+    {
+        size_t ntasks = 0;
+        for (size_t r = 0; r + 1 < nruns; r += 2)
+            tasks[ntasks++] = (merge_task_t){ bounds[r], bounds[r + 1], bounds[r + 2] };
+
+        mctx.tasks = tasks;
+        mctx.halves = tasks + maxtasks;
+
+        /* split merges until every worker has its own */
+        while (ntasks < (size_t)nworkers)
+        {
+            mctx.split = 0;
+
+            pmergesort_apply(ntasks, _(merge_half), &mctx);
+
+            merge_task_t * t = mctx.tasks;
+            mctx.tasks = mctx.halves;
+            mctx.halves = t;
+
+            ntasks <<= 1;
+
+            if (!mctx.split)
+                break;
+        }
+
+        pmergesort_apply(ntasks, _(merge_task), &mctx);
+
+        size_t m = 0;
+        for (size_t r = 0; r < nruns; r += 2)
+            bounds[m++] = bounds[r];
+
+        bounds[m] = bounds[nruns];
+        nruns = m;
+    }
+
+    PMR_FREE(bounds);
+    PMR_FREE(tasks);
+
+    return mctx.rc;
+}
+
+/*
+ * run a goes before run b: its head is less, or equal and the run is earlier; exhausted runs go last
+ */
+static inline int _(kway_before)(size_t a, size_t b, void ** cur, void ** end, context_t * ctx)
+{
+    if (cur[a] == end[a])
+        return 0;
+
+    if (cur[b] == end[b])
+        return 1;
+
+    int rc = CALL_CMP(ctx, cur[a], cur[b]);
+
+    return rc < 0 || (rc == 0 && a < b);
+}
+
+/*
+ * merge n elements of k runs [cur, end) to dst with loser tree (k - 1 internal nodes, winner at 0)
+ */
+static inline void _(kway_merge)(void * dst, size_t n, void ** cur, void ** end, size_t * tree, size_t k, context_t * ctx)
+{
+    size_t sz = ELT_SZ(ctx);
+
+    if (k == 1)
+    {
+        _M(copy)(cur[0], dst, n, sz);
+        return;
+    }
+
+    /* a leaf climbs up to the empty node to wait there for the winner of other subtree */
+    for (size_t i = 1; i < k; i++)
+        tree[i] = SIZE_MAX;
+
+    for (size_t r = 0; r < k; r++)
+    {
+        size_t w = r;
+        size_t node = (r + k) >> 1;
+
+        for (; node != 0; node >>= 1)
+        {
+            if (tree[node] == SIZE_MAX)
+            {
+                tree[node] = w;
+                break;
+            }
+
+            if (_(kway_before)(tree[node], w, cur, end, ctx))
+            {
+                size_t t = tree[node];
+                tree[node] = w;
+                w = t;
+            }
+        }
+
+        if (node == 0)
+            tree[0] = w;
+    }
+
+    for (; n != 0; n--)
+    {
+        size_t w = tree[0];
+
+        _M(copy)(cur[w], dst, 1, sz);
+
+        dst = ELT_PTR_NEXT(ctx, dst);
+        cur[w] = ELT_PTR_NEXT(ctx, cur[w]);
+
+        for (size_t node = (w + k) >> 1; node != 0; node >>= 1)
+        {
+            if (_(kway_before)(tree[node], w, cur, end, ctx))
+            {
+                size_t t = tree[node];
+                tree[node] = w;
+                w = t;
+            }
+        }
+
+        tree[0] = w;
+    }
+}
+
+static void _(kway_part)(void * arg, size_t p)
+{
+    merge_runs_context_t * mctx = arg;
+    context_t * ctx = mctx->ctx;
+
+    size_t k = mctx->nruns;
+    void ** lo = &mctx->bounds[p * k];
+    void ** hi = &mctx->bounds[(p + 1) * k];
+
+    size_t off = 0;
+    size_t len = 0;
+    for (size_t r = 0; r < k; r++)
+    {
+        off += ELT_DIST(ctx, lo[r], mctx->bounds[r]);
+        len += ELT_DIST(ctx, hi[r], lo[r]);
+    }
+
+    size_t * tree = PMR_MALLOC((sizeof(size_t) + sizeof(void *)) * k);
+    if (tree == NULL)
+    {
+        (void)__sync_bool_compare_and_swap(&mctx->rc, 0, 1);
+        return;
+    }
+
+    void ** cur = (void **)(tree + k);
+    memcpy(cur, lo, sizeof(void *) * k);
+
+    _(kway_merge)(ELT_PTR_FWD(ctx, mctx->dst, off), len, cur, hi, tree, k, ctx);
+
+    PMR_FREE(tree);
+}
+
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS || PMR_PARALLEL_USE_OMP
+/*
+ * order of sample pointers: by element, then by address (that is by run and position)
+ */
+static int _(kway_sample_cmp)(void * thunk, const void * a, const void * b)
+{
+    context_t * ctx = thunk;
+
+    void * x = *(void * const *)a;
+    void * y = *(void * const *)b;
+
+    int rc = CALL_CMP(ctx, x, y);
+
+    return rc != 0 ? rc : (x < y ? -1 : x > y);
+}
+#endif
+
+/*
+ * merge k runs [lo, hi) to dst, runs are at ascending addresses (not necessarily adjacent), ctx->n is their total length
+ */
+static inline int _(kway_merge_spans)(context_t * ctx, void * dst, void * const * lo, void * const * hi, size_t nruns)
+{
+    if (ctx->n < 2)
+    {
+        for (size_t r = 0; r < nruns; r++)
+        {
+            _M(copy)(lo[r], dst, ELT_DIST(ctx, hi[r], lo[r]), ELT_SZ(ctx));
+            dst = ELT_PTR_FWD(ctx, dst, ELT_DIST(ctx, hi[r], lo[r]));
+        }
+
+        return 0;
+    }
+
+    _(tune)(ctx);
+
+    int numparts = 1;
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS || PMR_PARALLEL_USE_OMP
+    numparts = scaleCPU(ctx->n, ctx->ncpu, ctx->grain);
+    if (numparts < 1)
+        numparts = 1;
+#endif
+
+    /* row per part of the starts of its ranges in runs, the last row is ends of runs */
+    void ** bounds = PMR_MALLOC(sizeof(void *) * (numparts + 1) * nruns);
+    if (bounds == NULL)
+        return 1;
+
+    for (size_t r = 0; r < nruns; r++)
+    {
+        bounds[r] = lo[r];
+        bounds[numparts * nruns + r] = hi[r];
+    }
+
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS || PMR_PARALLEL_USE_OMP
+    if (numparts > 1)
+    {
+        /* sample of runs at the stride, so a part is longer than its share by stride per run at most */
+        size_t stride = ctx->n / ((size_t)numparts * (nruns > 16 ? nruns : 16));
+        if (stride == 0)
+            stride = 1;
+
+        size_t ns = 0;
+        for (size_t r = 0; r < nruns; r++)
+            ns += IDIV_UP(ELT_DIST(ctx, hi[r], lo[r]), stride);
+
+        void ** sample = PMR_MALLOC(sizeof(void *) * ns);
+        if (sample == NULL)
+        {
+            PMR_FREE(bounds);
+            return 1;
+        }
+
+        size_t i = 0;
+        for (size_t r = 0; r < nruns; r++)
+        {
+            for (void * p = lo[r]; p < hi[r]; p = ELT_PTR_FWD(ctx, p, stride))
+            {
+                sample[i++] = p;
+
+                if ((size_t)ELT_DIST(ctx, hi[r], p) <= stride)
+                    break;
+            }
+        }
+
+        int rc = pmergesort_r(sample, ns, sizeof(void *), ctx, _(kway_sample_cmp));
+        if (rc != 0)
+        {
+            PMR_FREE(sample);
+            PMR_FREE(bounds);
+            return rc;
+        }
+
+        /* the splitter goes to its part, equal elements of earlier runs go before it and of later runs after it */
+        for (int p = 1; p < numparts; p++)
+        {
+            void * x = sample[p * ns / numparts];
+
+            size_t rx = 0;
+            while (x >= bounds[numparts * nruns + rx])
+                rx++;
+
+            for (size_t r = 0; r < nruns; r++)
+            {
+                void * rlo = bounds[r];
+                void * rhi = bounds[numparts * nruns + r];
+
+                bounds[p * nruns + r] = r < rx ? _(ip)(x, rlo, rhi, -1, ctx) : (r > rx ? _(ip)(x, rlo, rhi, 0, ctx) : x);
+            }
+        }
+
+        PMR_FREE(sample);
+    }
+#endif
+
+    merge_runs_context_t mctx;
+    memset(&mctx, 0, sizeof(mctx));
+
+    mctx.ctx = ctx;
+    mctx.dst = dst;
+    mctx.nruns = nruns;
+    mctx.bounds = bounds;
+
+    if (numparts > 1)
+        pmergesort_apply(numparts, _(kway_part), &mctx);
+    else
+        _(kway_part)(&mctx, 0);
+
+    PMR_FREE(bounds);
+
+    return mctx.rc;
+}
+
+static inline int _(kway_merge_runs)(context_t * ctx, void * dst, const size_t * offs, size_t nruns)
+{
+    void ** spans = PMR_MALLOC(sizeof(void *) * 2 * nruns);
+    if (spans == NULL)
+        return 1;
+
+    for (size_t r = 0; r < nruns; r++)
+    {
+        spans[r] = ELT_PTR_FWD(ctx, ctx->base, offs[r] - offs[0]);
+        spans[nruns + r] = ELT_PTR_FWD(ctx, ctx->base, offs[r + 1] - offs[0]);
+    }
+
+    int rc = _(kway_merge_spans)(ctx, dst, spans, spans + nruns, nruns);
+
+    PMR_FREE(spans);
+
+    return rc;
+}
+
+/*
+ * streaming merge: cut windows [lo, hi) of runs to the elements that go before the elements not loaded yet, that is up to
+ * the least last element of windows of runs with more to load (tail[r] is zero), returns total length of cut windows
+ */
+static inline size_t _(kway_cut)(context_t * ctx, void * const * lo, void ** hi, const int * tail, size_t nruns)
+{
+    size_t b = SIZE_MAX;
+    for (size_t r = 0; r < nruns; r++)
+    {
+        if (tail[r] || lo[r] == hi[r])
+            continue;
+
+        if (b == SIZE_MAX || CALL_CMP(ctx, ELT_PTR_PREV(ctx, hi[r]), ELT_PTR_PREV(ctx, hi[b])) < 0)
+            b = r;
+    }
+
+    size_t n = 0;
+    if (b != SIZE_MAX)
+    {
+        void * x = ELT_PTR_PREV(ctx, hi[b]);
+
+        for (size_t r = 0; r < nruns; r++)
+        {
+            if (r != b)
+                hi[r] = _(ip)(x, lo[r], hi[r], r < b ? -1 : 0, ctx);
+        }
+    }
+
+    for (size_t r = 0; r < nruns; r++)
+        n += ELT_DIST(ctx, hi[r], lo[r]);
+
+    return n;
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  incremental sort of growing sorted array: the appended tail is sorted on its own and merged into sorted prefix            */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+static inline int _(sort_appended)(context_t * ctx, size_t nsorted, int inplace)
+{
+    size_t ntail = ctx->n - nsorted;
+
+    int rc = 0;
+    if (ntail >= 2)
+    {
+        context_t tctx = _ctx_sub(ctx, ELT_PTR_FWD(ctx, ctx->base, nsorted), ntail, ctx->thpool);
+
+        rc = inplace ? _(symmergesort)(&tctx) : _(pmergesort)(&tctx);
+    }
+
+    if (rc != 0 || nsorted == 0 || ntail == 0)
+        return rc;
+
+    /* merges split in halves run on the threads of pmergesort_apply, so no spawn inside of them */
+    context_t mctx = _ctx_sub(ctx, ctx->base, ctx->n, NULL);
+
+    size_t offs[3] = { 0, nsorted, ctx->n };
+
+    return _(merge_runs)(&mctx, offs, 2, inplace);
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  compaction: the kept elements of chunks are moved to the front of the 1st chunk and to temporary storage at the offsets   */
+/*  of other chunks in parallel, then chunks are moved to their destinations in parallel; without temporary storage chunks    */
+/*  are compacted in place and joined one by one                                                                              */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+static __attribute__((unused)) void _(compact_chunk)(void * arg, size_t i)
+{
+    compact_context_t * cctx = arg;
+    context_t * ctx = cctx->ctx;
+
+    void * lo = ELT_PTR_FWD(ctx, ctx->base, i * cctx->chunksz);
+    void * hi = i + 1 < cctx->numchunks ? ELT_PTR_FWD(ctx, lo, cctx->chunksz) : ELT_PTR_FWD(ctx, ctx->base, ctx->n);
+
+    void * dst = i == 0 || cctx->temp == NULL ? lo : ELT_PTR_FWD(ctx, cctx->temp, (i - 1) * cctx->chunksz);
+    for (void * p = lo; p < hi; p = ELT_PTR_NEXT(ctx, p))
+    {
+        if (cctx->deleted((void *)ctx->thunk, p))
+            continue;
+
+        if (dst != p)
+            _M(copy)(p, dst, 1, ELT_SZ(ctx));
+
+        dst = ELT_PTR_NEXT(ctx, dst);
+    }
+
+    cctx->ends[i] = dst;
+}
+
+static __attribute__((unused)) void _(compact_move)(void * arg, size_t i)
+{
+    compact_context_t * cctx = arg;
+    context_t * ctx = cctx->ctx;
+
+    if (i == 0)
+        return; /* in place already */
+
+    void * lo = ELT_PTR_FWD(ctx, cctx->temp, (i - 1) * cctx->chunksz);
+    size_t n = ELT_DIST(ctx, cctx->ends[i], lo);
+
+    if (n != 0)
+        PMR_MEMCPY(ELT_PTR_FWD(ctx, ctx->base, cctx->offs[i]), lo, ELT_OF_SZ(n, ELT_SZ(ctx)));
+}
+
+static inline size_t _(compact)(context_t * ctx, int (*deleted)(void *, const void *))
+{
+    int numchunks = 1;
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS || PMR_PARALLEL_USE_OMP
+    numchunks = scaleCPU(ctx->n, ctx->ncpu, _PMR_PARALLEL_GRAIN);
+    if (numchunks < 1)
+        numchunks = 1;
+#endif
+
+    void * ends[numchunks];
+    size_t offs[numchunks];
+
+    compact_context_t cctx = { ctx, deleted, ctx->n / numchunks, numchunks, ends, NULL, offs };
+
+    if (numchunks > 1)
+    {
+        cctx.temp = PMR_MALLOC(ELT_OF_SZ(ctx->n - cctx.chunksz, ELT_SZ(ctx)));
+
+        pmergesort_apply(numchunks, _(compact_chunk), &cctx);
+    }
+    else
+        _(compact_chunk)(&cctx, 0);
+
+    if (cctx.temp == NULL)
+    {
+        void * dst = ends[0];
+        for (int i = 1; i < numchunks; i++)
+        {
+            void * lo = ELT_PTR_FWD(ctx, ctx->base, i * cctx.chunksz);
+            size_t n = ELT_DIST(ctx, ends[i], lo);
+
+            if (n != 0)
+                PMR_MEMMOVE(dst, lo, ELT_OF_SZ(n, ELT_SZ(ctx)));
+
+            dst = ELT_PTR_FWD(ctx, dst, n);
+        }
+
+        return ELT_DIST(ctx, dst, ctx->base);
+    }
+
+    size_t m = ELT_DIST(ctx, ends[0], ctx->base);
+    for (int i = 1; i < numchunks; i++)
+    {
+        offs[i] = m;
+        m += ELT_DIST(ctx, ends[i], ELT_PTR_FWD(ctx, cctx.temp, (i - 1) * cctx.chunksz));
+    }
+
+    pmergesort_apply(numchunks, _(compact_move), &cctx);
+
+    PMR_FREE(cctx.temp);
+
+    return m;
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  sort and unique: the halves are sorted, and the output of their merge is dealt to chunks by rank, so chunks merge their   */
+/*  parts to temporary storage in parallel and drop (or reduce into the kept one) the elements equal to the last kept one on  */
+/*  the way; a chunk starting inside of a group of equals holds its leading ones in its 1st element, which is reduced into    */
+/*  the last kept element of previous chunks (or dropped), then chunks are moved to their destinations in parallel           */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+static __attribute__((unused)) void _(unique_chunk)(void * arg, size_t i)
+{
+    unique_context_t * uctx = arg;
+    context_t * ctx = uctx->ctx;
+
+    size_t na = uctx->na;
+    size_t nb = ctx->n - na;
+
+    void * a = (void *)ctx->base;
+    void * b = ELT_PTR_FWD(ctx, a, na);
+
+    /* ranks [t, te) of merge go to the chunk */
+    size_t t = i * uctx->chunksz;
+    size_t te = i + 1 < uctx->numchunks ? t + uctx->chunksz : ctx->n;
+
+    size_t ia = _(corank)(t, a, na, b, nb, ctx);
+    size_t iae = _(corank)(te, a, na, b, nb, ctx);
+
+    void * pa = ELT_PTR_FWD(ctx, a, ia);
+    void * ae = ELT_PTR_FWD(ctx, a, iae);
+    void * pb = ELT_PTR_FWD(ctx, b, t - ia);
+    void * be = ELT_PTR_FWD(ctx, b, te - iae);
+
+    void * lo = ELT_PTR_FWD(ctx, uctx->temp, t);
+    void * dst = lo;
+
+    while (pa < ae || pb < be)
+    {
+        void * p;
+        if (pb == be || (pa < ae && CALL_CMP(ctx, pa, pb) <= 0))
+        {
+            p = pa;
+            pa = ELT_PTR_NEXT(ctx, pa);
+        }
+        else
+        {
+            p = pb;
+            pb = ELT_PTR_NEXT(ctx, pb);
+        }
+
+        if (dst != lo)
+        {
+            void * last = ELT_PTR_PREV(ctx, dst);
+
+            if (CALL_CMP(ctx, last, p) == 0)
+            {
+                if (uctx->reduce != NULL)
+                    uctx->reduce((void *)ctx->thunk, last, p);
+
+                continue;
+            }
+        }
+
+        _M(copy)(p, dst, 1, ELT_SZ(ctx));
+
+        dst = ELT_PTR_NEXT(ctx, dst);
+    }
+
+    uctx->ends[i] = dst;
+}
+
+static __attribute__((unused)) void _(unique_move)(void * arg, size_t i)
+{
+    unique_context_t * uctx = arg;
+    context_t * ctx = uctx->ctx;
+
+    size_t n = ELT_DIST(ctx, uctx->ends[i], uctx->starts[i]);
+
+    if (n != 0)
+        PMR_MEMCPY(ELT_PTR_FWD(ctx, ctx->base, uctx->offs[i]), uctx->starts[i], ELT_OF_SZ(n, ELT_SZ(ctx)));
+}
+
+static inline int _(sort_unique)(context_t * ctx, void (*reduce)(void *, void *, const void *), size_t * m)
+{
+    size_t na = ctx->n >> 1;
+
+    context_t actx = _ctx_sub(ctx, ctx->base, na, ctx->thpool);
+    context_t bctx = _ctx_sub(ctx, ELT_PTR_FWD(ctx, ctx->base, na), ctx->n - na, ctx->thpool);
+
+    int rc = _(pmergesort)(&actx);
+    if (rc == 0)
+        rc = _(pmergesort)(&bctx);
+
+    if (rc != 0)
+        return rc;
+
+    void * temp = PMR_MALLOC(ELT_OF_SZ(ctx->n, ELT_SZ(ctx)));
+    if (temp == NULL)
+        return 1;
+
+    int numchunks = 1;
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS || PMR_PARALLEL_USE_OMP
+    numchunks = scaleCPU(ctx->n, ctx->ncpu, _PMR_PARALLEL_GRAIN);
+    if (numchunks < 1)
+        numchunks = 1;
+#endif
+
+    void * starts[numchunks];
+    void * ends[numchunks];
+    size_t offs[numchunks];
+
+    unique_context_t uctx = { ctx, reduce, na, temp, ctx->n / numchunks, numchunks, starts, ends, offs };
+
+    if (numchunks > 1)
+        pmergesort_apply(numchunks, _(unique_chunk), &uctx);
+    else
+        _(unique_chunk)(&uctx, 0);
+
+    void * last = NULL;
+    size_t k = 0;
+    for (int i = 0; i < numchunks; i++)
+    {
+        void * lo = ELT_PTR_FWD(ctx, temp, i * uctx.chunksz);
+
+        if (last != NULL && CALL_CMP(ctx, last, lo) == 0)
+        {
+            if (reduce != NULL)
+                reduce((void *)ctx->thunk, last, lo);
+
+            lo = ELT_PTR_NEXT(ctx, lo);
+        }
+
+        starts[i] = lo;
+        offs[i] = k;
+        k += ELT_DIST(ctx, ends[i], lo);
+
+        if (lo < ends[i])
+            last = ELT_PTR_PREV(ctx, ends[i]);
+    }
+
+    if (numchunks > 1)
+        pmergesort_apply(numchunks, _(unique_move), &uctx);
+    else
+        _(unique_move)(&uctx, 0);
+
+    PMR_FREE(temp);
+
+    *m = k;
+
+    return 0;
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  segmented sort: the segments are dealt to chunks of about the same number of elements, and chunks sort their segments in  */
+/*  parallel by the kernels of small arrays, with temporary storage of chunk reused by all of its segments; a segment longer  */
+/*  than the share of chunk would unbalance them, so it is left to be sorted after by parallel pmergesort                     */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+static __attribute__((unused)) void _(segmented_chunk)(void * arg, size_t i)
+{
+    segmented_context_t * sctx = arg;
+    context_t * ctx = sctx->ctx;
+    aux_t * aux = &sctx->auxes[i];
+
+    for (size_t s = sctx->bounds[i]; s < sctx->bounds[i + 1]; s++)
+    {
+        size_t n = sctx->offs[s + 1] - sctx->offs[s];
+        if (n < 2 || n > sctx->share)
+            continue;
+
+        void * lo = ELT_PTR_FWD(ctx, ctx->base, sctx->offs[s] - sctx->offs[0]);
+        void * hi = ELT_PTR_FWD(ctx, lo, n);
+
+        if (n < _PMR_BLOCKLEN_MTHRESHOLD0 * _PMR_BLOCKLEN_SYMMERGE)
+            _(_PMR_PRESORT)(lo, lo, hi, ctx, NULL);
+        else if (_(aux_sort)(lo, hi, ctx, aux) != 0)
+            break;
+    }
+
+    _aux_free(aux);
+}
+
+static inline int _(segmented_sort)(context_t * ctx, const size_t * offs, size_t nsegs)
+{
+    tuneCost(ctx, ctx->cost);
+
+    int numchunks = 1;
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS || PMR_PARALLEL_USE_OMP
+    /* more chunks than threads, so the threads free first take the rest */
+    numchunks = scaleCPU(ctx->n, ctx->ncpu, _PMR_PARALLEL_GRAIN) * _PMR_SEGMENTED_CHUNKS;
+    if (numchunks < 1)
+        numchunks = 1;
+    if ((size_t)numchunks > nsegs)
+        numchunks = (int)nsegs;
+#endif
+
+    size_t bounds[numchunks + 1];
+    aux_t auxes[numchunks];
+
+    segmented_context_t sctx = { ctx, offs, bounds, numchunks, auxes, numchunks > 1 ? IDIV_UP(ctx->n, numchunks) : ctx->n };
+
+    /* chunk i takes the segments starting in [n * i / numchunks, n * (i + 1) / numchunks) */
+    bounds[0] = 0;
+    for (int i = 1; i < numchunks; i++)
+    {
+        size_t at = offs[0] + ctx->n * i / numchunks;
+        size_t lo = bounds[i - 1];
+        size_t hi = nsegs;
+
+        while (lo < hi)
+        {
+            size_t mi = lo + ((hi - lo) >> 1);
+
+            if (offs[mi] < at)
+                lo = mi + 1;
+            else
+                hi = mi;
+        }
+
+        bounds[i] = lo;
+    }
+    bounds[numchunks] = nsegs;
+
+    for (int i = 0; i < numchunks; i++)
+        auxes[i] = (aux_t){ .parent = &auxes[i] };
+
+    if (numchunks > 1)
+        pmergesort_apply(numchunks, _(segmented_chunk), &sctx);
+    else
+        _(segmented_chunk)(&sctx, 0);
+
+    for (int i = 0; i < numchunks; i++)
+    {
+        if (auxes[i].rc != 0)
+            return auxes[i].rc;
+    }
+
+    /* long segments on all threads */
+    for (size_t s = 0; s < nsegs; s++)
+    {
+        size_t n = offs[s + 1] - offs[s];
+        if (n <= sctx.share)
+            continue;
+
+        context_t sub = _ctx_sub(ctx, ELT_PTR_FWD(ctx, ctx->base, offs[s] - offs[0]), n, ctx->thpool);
+
+        int rc = _(pmergesort)(&sub);
+        if (rc != 0)
+            return rc;
+    }
+
+    return 0;
+}
+
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  asynchronous mergesort: every pass is a batch of jobs, the next pass is scheduled as continuation when the batch (spawned */
+/*  jobs included) is finished, by the last finished job on pthreads pool or by notification of sort group on GCD, so no     */
+/*  thread waits for the sort                                                                                                 */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+#if PMR_PARALLEL_USE_PTHREADS
+static void * _(async_sort_chunk_pass)(void * arg)
+{
+    pmr_async_t * async = ((pmergesort_pass_context_t *)arg)->ctx->async;
+
+    (void)_(sort_chunk_pass_ex)(arg);
+
+    _async_release(async);
+
+    return NULL;
+}
+
+static void * _(async_merge_chunks_pass)(void * arg)
+{
+    pmr_async_t * async = ((pmergesort_pass_context_t *)arg)->ctx->async;
+
+    (void)_(merge_chunks_pass_ex)(arg);
+
+    _async_release(async);
+
+    return NULL;
+}
+#else
+static void _(async_sort_chunk_pass)(void * arg)
+{
+    _(sort_chunk_pass)(arg, ((pmergesort_pass_context_t *)arg)->chunk);
+}
+
+static void _(async_merge_chunks_pass)(void * arg)
+{
+    _(merge_chunks_pass)(arg, ((pmergesort_pass_context_t *)arg)->chunk);
+}
+#endif
+
+static void _(async_step)(void * arg)
+{
+    pmr_async_t * async = arg;
+    context_t * ctx = &async->ctx;
+
+    for (int i = 0; i < ctx->ncpu; i++)
+    {
+        if (async->auxes[i].rc != 0)
+        {
+            _async_complete(async, 0); /* bail out */
+            return;
+        }
+    }
+
+    size_t bsz = async->bsz;
+    if (async->pass2 && bsz >= ctx->n)
+    {
+        _async_complete(async, 0); /* we're done */
+        return;
+    }
+
+    /* divide the array up into up to ncores, multiple-of-block-sized (pass 1) or double-block-sized (pass 2), chunks */
+    size_t span = async->pass2 ? bsz << 1 : bsz;
+    size_t chunksz = IDIV_UP(ctx->npercpu, span) * span;
+    size_t numchunks = IDIV_UP(ctx->n, chunksz);
+
+#if PMR_PARALLEL_USE_PTHREADS
+    void * (*pass)(void *) = async->pass2 ? _(async_merge_chunks_pass) : _(async_sort_chunk_pass);
+#else
+    void (*pass)(void *) = async->pass2 ? _(async_merge_chunks_pass) : _(async_sort_chunk_pass);
+#endif
+
+    if (async->pass2)
+    {
+        /* let's be less greedy for temporary memory */
+        for (int i = (int)numchunks; i < ctx->ncpu; i++)
+            _aux_free(&async->auxes[i]);
+    }
+
+    for (size_t chunk = 0; chunk < numchunks; chunk++)
+    {
+        pmergesort_pass_context_t * pass_ctx = &async->pass_ctx[chunk];
+        pass_ctx->ctx = ctx;
+        pass_ctx->bsz = bsz;
+        pass_ctx->dbl_bsz = bsz << 1;
+        pass_ctx->chunksz = chunksz;
+        pass_ctx->numchunks = numchunks;
+        pass_ctx->chunk = chunk;
+        pass_ctx->lo = (void *)ctx->base;
+        pass_ctx->mi = NULL;
+        pass_ctx->hi = ELT_PTR_FWD(ctx, pass_ctx->lo, ctx->n);
+        pass_ctx->effector = async->pass2 ? ctx->merge_effector : ctx->sort_effector;
+        pass_ctx->auxes = async->auxes;
+    }
+
+    /* advance to the next pass before any job of this one is completed */
+    if (async->pass2)
+        async->bsz = bsz << 1;
+    else
+        async->pass2 = 1;
+
+#if PMR_PARALLEL_USE_PTHREADS
+    async->pending = numchunks + 1; /* the extra one holds the pass until all jobs are queued */
+
+    for (size_t chunk = 0; chunk < numchunks; chunk++)
+    {
+        if (thr_pool_queue(ctx->thpool, pass, &async->pass_ctx[chunk]) != 0)
+            (void)pass(&async->pass_ctx[chunk]); /* failed to queue, do it in place */
+    }
+
+    _async_release(async);
+#else
+    /* spawned merges join the same group, so the notification comes after all of them */
+    for (size_t chunk = 0; chunk < numchunks; chunk++)
+        dispatch_group_async_f(ctx->thpool->group, ctx->thpool->queue, &async->pass_ctx[chunk], pass);
+
+    dispatch_group_notify_f(ctx->thpool->group, ctx->thpool->queue, async, _(async_step));
+#endif
+}
+
+#if PMR_PARALLEL_USE_PTHREADS
+static void * _(async_serial)(void * arg)
+#else
+static void _(async_serial)(void * arg)
+#endif
+{
+    pmr_async_t * async = arg;
+
+    async->ctx.thpool = NULL; /* disable threads spawn */
+
+    _async_complete(async, _(pmergesort_serial)(&async->ctx));
+
+#if PMR_PARALLEL_USE_PTHREADS
+    return NULL;
+#endif
+}
+
+static inline void _(pmergesort_async)(pmr_async_t * async)
+{
+    context_t * ctx = &async->ctx;
+
+#if PMR_PARALLEL_USE_PTHREADS
+    async->step = _(async_step);
+#endif
+
+    if (_(pmergesort_plan)(ctx))
+    {
+        async->pass2 = 0;
+        async->bsz = ctx->bsize;
+
+        _(async_step)(async);
+    }
+#if PMR_PARALLEL_USE_PTHREADS
+    else if (thr_pool_queue(ctx->thpool, _(async_serial), async) != 0)
+        (void)_(async_serial)(async); /* failed to queue, do it in place */
+#else
+    else
+        dispatch_async_f(ctx->thpool->queue, async, _(async_serial));
+#endif
+}
+#endif
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  compound mergesort (symmerge based) with wrapped pre-sort function                                                        */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+static __attribute__((unused)) void _(wrap_sort)(void * lo, __unused void * mi, void * hi, context_t * ctx, aux_t * aux)
+{
+    aux->rc = CALL_SORT(ctx, lo, ELT_DIST(ctx, hi, lo)); /* FIXME: atomic */
+}
+
+static inline int _(wrapmergesort)(context_t * ctx)
+{
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS || PMR_PARALLEL_USE_OMP
+    if (ctx->n >= 2 * _PMR_BLOCKLEN_MTHRESHOLD0 * _PMR_BLOCKLEN_SYMMERGE)
+    {
+        _(tune)(ctx);
+
+        for (int ncpu = scaleCPU(ctx->n, ctx->ncpu, ctx->grain); ncpu > 1; ncpu--)
+        {
+            size_t npercpu = IDIV_UP(ctx->n, ncpu);
+            if (npercpu >= 2 * _PMR_BLOCKLEN_MTHRESHOLD * _PMR_BLOCKLEN_SYMMERGE)
+            {
+                /* use parallel when have a long enough array could be distributed by cores */
+
+                /* pre-set initial pass values */
                 ctx->npercpu = npercpu;
                 ctx->bsize = npercpu;
                 ctx->sort_effector = _(wrap_sort);
                 ctx->merge_effector = _(aux_symmerge);
 
-#if PMR_PARALLEL_USE_OMP && _PMR_PARALLEL_MAY_SPAWN
-                thr_pool_t pool;
-                pool.ncpu = ctx->ncpu; /* utilize maximum number of cores when symmerge spawns threads */
-
-                ctx->thpool = &pool;
-#endif
-
                 /* run parallel sort */
                 return _(pmergesort_impl)(ctx);
             }
@@ -0,0 +1,841 @@
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  pmergesort-extsort.inl                                                                                                    */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  Created by Cyril Murzin                                                                                                   */
+/*  Copyright (c) 2015-2017 Ravel Developers Group. All rights reserved.                                                      */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  external sort of files of fixed size records (local files, POSIX I/O)                                                     */
+/*                                                                                                                            */
+/*  runs: chunks of the third of memory budget are read, sorted by pmergesort and written to temporary file; the I/O thread   */
+/*  writes the previous run and reads the next chunk to the other buffer while the current chunk is sorted, the last third    */
+/*  is the scratch of pmergesort                                                                                              */
+/*                                                                                                                            */
+/*  merge: every run has a window of loaded elements and a block read ahead; the windows are cut to the elements that go      */
+/*  before anything not loaded yet, and merged by parallel k-way merge while the I/O thread writes the previous output and    */
+/*  reads ahead the next blocks; the windows take the budget left by the bookkeeping of merge, and too many runs for the      */
+/*  budget are merged in several passes                                                                                       */
+/*                                                                                                                            */
+/*  in-place sort of file: the file is mapped shared and sorted in the page cache, with no read to and write from the heap    */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define _PMR_EXTSORT_BUDGET         ((size_t)256 << 20) /* default memory budget */
+#define _PMR_EXTSORT_MIN_BLOCK      ((size_t)256 << 10) /* min. block read of run at merge, limits the fan-in of pass */
+#define _PMR_EXTSORT_MAX_IO         ((size_t)1 << 30)   /* max. length of read or write call */
+
+typedef int (*extsort_sort_t)(context_t * ctx);
+typedef int (*extsort_merge_t)(context_t * ctx, void * dst, void * const * lo, void * const * hi, size_t nruns);
+typedef size_t (*extsort_cut_t)(context_t * ctx, void * const * lo, void ** hi, const int * tail, size_t nruns);
+
+struct _extsort
+{
+    context_t *     ctx;        /* comparator, element size and options, n is not used */
+
+    extsort_sort_t  sort;
+    extsort_sort_t  inplace;    /* sort with no scratch */
+    extsort_merge_t merge;
+    extsort_cut_t   cut;
+
+    size_t          budget;     /* memory budget in bytes */
+    const char *    tmpdir;     /* directory of temporary files */
+};
+typedef struct _extsort extsort_t;
+
+struct _extsort_op
+{
+    int             fd;
+    int             wr;         /* write, else read */
+    void *          buf;
+    size_t          len;        /* in bytes */
+    off_t           off;
+};
+typedef struct _extsort_op extsort_op_t;
+
+struct _extsort_io
+{
+    pthread_t       thread;
+    int             started;    /* thread is running the ops */
+    int             rc;         /* errno of the 1st failed op, or 0 */
+
+    size_t          nops;
+    extsort_op_t *  ops;
+};
+typedef struct _extsort_io extsort_io_t;
+
+struct _extsort_run
+{
+    off_t           off;        /* offset in file in elements */
+    size_t          n;          /* number of elements */
+};
+typedef struct _extsort_run extsort_run_t;
+
+struct _extsort_merger
+{
+    extsort_t *             es;
+    int                     fd;
+    const extsort_run_t *   runs;
+    size_t                  nruns;
+
+    size_t                  blk;        /* block read of run */
+    size_t                  wcap;       /* capacity of window of run, 2 blocks */
+
+    void *                  mem;
+    void *                  windows;    /* windows of runs */
+    void *                  ahead;      /* blocks read ahead */
+    void *                  outs[2];    /* output buffers */
+    int                     k;          /* output buffer of the next step */
+
+    size_t *                pos;        /* number of elements of run read */
+    size_t *                len;        /* number of elements in window */
+    size_t *                alen;       /* number of elements read ahead */
+    size_t *                aread;      /* number of elements being read ahead */
+    void **                 lo;
+    void **                 hi;
+    int *                   tail;       /* window holds the rest of run */
+
+    extsort_io_t            io;
+
+    size_t                  left;       /* number of elements to merge */
+    void *                  out;        /* output of the last step */
+    size_t                  nout;
+};
+typedef struct _extsort_merger extsort_merger_t;
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  I/O                                                                                                                       */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+/*
+ * read or write all of op, returns errno or 0
+ */
+static int _extsort_pio(const extsort_op_t * op)
+{
+    char * p = op->buf;
+    size_t len = op->len;
+    off_t off = op->off;
+
+    while (len != 0)
+    {
+        size_t chunk = len < _PMR_EXTSORT_MAX_IO ? len : _PMR_EXTSORT_MAX_IO;
+
+        ssize_t rc = op->wr ? pwrite(op->fd, p, chunk, off) : pread(op->fd, p, chunk, off);
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return errno;
+        }
+
+        if (rc == 0)
+            return EIO; /* the file is shorter than expected */
+
+        p += rc;
+        len -= (size_t)rc;
+        off += rc;
+    }
+
+    return 0;
+}
+
+static void * __extsort_io_run(void * arg)
+{
+    extsort_io_t * io = arg;
+
+    for (size_t i = 0; i < io->nops && io->rc == 0; i++)
+        io->rc = _extsort_pio(&io->ops[i]);
+
+    return NULL;
+}
+
+/*
+ * run the ops of io in background (or right away if thread can't be created)
+ */
+static void _extsort_io_start(extsort_io_t * io)
+{
+    io->rc = 0;
+    io->started = 0;
+
+    if (io->nops == 0)
+        return;
+
+    if (pthread_create(&io->thread, NULL, __extsort_io_run, io) == 0)
+        io->started = 1;
+    else
+        (void)__extsort_io_run(io);
+}
+
+static int _extsort_io_finish(extsort_io_t * io)
+{
+    if (io->started)
+        (void)pthread_join(io->thread, NULL);
+
+    io->started = 0;
+    io->nops = 0;
+
+    return io->rc;
+}
+
+static inline void _extsort_io_add(extsort_io_t * io, int fd, int wr, void * buf, size_t len, off_t off)
+{
+    extsort_op_t * op = &io->ops[io->nops++];
+
+    op->fd = fd;
+    op->wr = wr;
+    op->buf = buf;
+    op->len = len;
+    op->off = off;
+}
+
+/*
+ * create temporary file in dir (or $TMPDIR, or /tmp), it is unlinked right away, so it goes away on close
+ */
+static int _extsort_tmpfile(const char * dir)
+{
+    if (dir == NULL || *dir == 0)
+        dir = getenv("TMPDIR");
+
+    if (dir == NULL || *dir == 0)
+        dir = "/tmp";
+
+    static const char name[] = "/pmergesort-XXXXXX";
+
+    size_t len = strlen(dir);
+    char * path = PMR_MALLOC(len + sizeof(name));
+    if (path == NULL)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    memcpy(path, dir, len);
+    memcpy(path + len, name, sizeof(name));
+
+    int fd = mkstemp(path);
+    if (fd >= 0)
+        (void)unlink(path);
+
+    PMR_FREE(path);
+
+    return fd;
+}
+
+static inline void * _extsort_at(void * base, size_t i, size_t sz)
+{
+    return (char *)base + i * sz;
+}
+
+static inline void _extsort_advise(int fd)
+{
+#ifdef POSIX_FADV_SEQUENTIAL
+    (void)posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#else
+    (void)fd;
+#endif
+}
+
+/*
+ * result of sort in memory to -1 with errno set on failure, like of I/O calls
+ */
+static inline int _extsort_rc(int rc)
+{
+    if (rc == 0)
+        return 0;
+
+    errno = rc == PMR_ECANCELED ? ECANCELED : (rc == PMR_ETIMEDOUT ? ETIMEDOUT : ENOMEM);
+
+    return -1;
+}
+
+/*
+ * result of external sort call, failures of sort itself are reported by PMR_Exxx (errno is kept)
+ */
+static inline int _extsort_result(int rc)
+{
+    if (rc == -1)
+    {
+        if (errno == ENOMEM)
+            rc = PMR_ENOMEM;
+        else if (errno == ECANCELED)
+            rc = PMR_ECANCELED;
+        else if (errno == ETIMEDOUT)
+            rc = PMR_ETIMEDOUT;
+    }
+
+    return rc;
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  run generation                                                                                                            */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+/*
+ * sort n elements at base, by the sort with no scratch if inplace is set
+ */
+static int _extsort_sort(extsort_t * es, void * base, size_t n, int inplace)
+{
+    if (n < 2)
+        return 0;
+
+    context_t * ctx = es->ctx;
+    context_t cctx = _ctx_sub(ctx, base, n, ctx->thpool);
+
+    return _extsort_rc(inplace ? es->inplace(&cctx) : es->sort(&cctx));
+}
+
+/*
+ * sort chunks of n elements of fd to runs of tmp
+ */
+static int _extsort_runs(extsort_t * es, int fd, size_t n, int tmp, extsort_run_t * runs, size_t nruns, size_t chunk)
+{
+    size_t sz = es->ctx->sz;
+
+    void * bufs[2];
+    bufs[0] = PMR_MALLOC(chunk * sz);
+    bufs[1] = PMR_MALLOC(chunk * sz);
+
+    extsort_op_t ops[2];
+    extsort_io_t io = { 0 };
+    io.ops = ops;
+
+    int rc = 0;
+    if (bufs[0] == NULL || bufs[1] == NULL)
+    {
+        errno = ENOMEM;
+        rc = -1;
+    }
+
+    for (size_t i = 0; i < nruns; i++)
+    {
+        runs[i].off = (off_t)(i * chunk);
+        runs[i].n = i + 1 < nruns ? chunk : n - i * chunk;
+    }
+
+    if (rc == 0)
+    {
+        _extsort_io_add(&io, fd, 0, bufs[0], runs[0].n * sz, 0);
+        _extsort_io_start(&io);
+        if ((errno = _extsort_io_finish(&io)) != 0)
+            rc = -1;
+    }
+
+    for (size_t i = 0; i < nruns && rc == 0; i++)
+    {
+        /* the buffer of previous run is written before the next chunk is read to it */
+        if (i > 0)
+            _extsort_io_add(&io, tmp, 1, bufs[(i - 1) & 1], runs[i - 1].n * sz, runs[i - 1].off * (off_t)sz);
+
+        if (i + 1 < nruns)
+            _extsort_io_add(&io, fd, 0, bufs[(i + 1) & 1], runs[i + 1].n * sz, runs[i + 1].off * (off_t)sz);
+
+        _extsort_io_start(&io);
+
+        rc = _extsort_sort(es, bufs[i & 1], runs[i].n, 0);
+
+        int err = _extsort_io_finish(&io);
+        if (rc == 0 && err != 0)
+        {
+            errno = err;
+            rc = -1;
+        }
+    }
+
+    if (rc == 0)
+    {
+        _extsort_io_add(&io, tmp, 1, bufs[(nruns - 1) & 1], runs[nruns - 1].n * sz, runs[nruns - 1].off * (off_t)sz);
+        _extsort_io_start(&io);
+        if ((errno = _extsort_io_finish(&io)) != 0)
+            rc = -1;
+    }
+
+    PMR_FREE(bufs[1]);
+    PMR_FREE(bufs[0]);
+
+    return rc;
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  merge                                                                                                                     */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+/*
+ * memory of merge of nruns runs besides the blocks: the bookkeeping of merger and runs, and of parallel k-way merge, that is
+ * the bounds of parts, the sample of runs along with the scratch of its sort and the tree of part
+ */
+static size_t _extsort_overhead(const extsort_t * es, size_t nruns)
+{
+    size_t ncpu = es->ctx->ncpu > 0 ? (size_t)es->ctx->ncpu : 1;
+
+    size_t run = sizeof(size_t) * 4 + sizeof(void *) * 2 + sizeof(int) + sizeof(extsort_op_t) + sizeof(extsort_run_t);
+    run += sizeof(void *) * (ncpu + 1) + sizeof(void *) * 2 * (ncpu + 1) + (sizeof(size_t) + sizeof(void *)) * ncpu;
+
+    return nruns * run + sizeof(void *) * 2 * 16 * ncpu + sizeof(extsort_op_t);
+}
+
+/*
+ * open merge of runs of fd, memory is 7 blocks per run: window of 2 blocks, block read ahead and 2 output buffers of 2 blocks,
+ * the blocks take the budget left by the overhead of merge
+ */
+static int _extsort_merger_open(extsort_merger_t * m, extsort_t * es, int fd, const extsort_run_t * runs, size_t nruns)
+{
+    size_t sz = es->ctx->sz;
+
+    memset(m, 0, sizeof(*m));
+
+    m->es = es;
+    m->fd = fd;
+    m->runs = runs;
+    m->nruns = nruns;
+
+    size_t overhead = _extsort_overhead(es, nruns);
+
+    m->blk = es->budget > overhead ? (es->budget - overhead) / (sz * 7 * nruns) : 0;
+    if (m->blk == 0)
+        m->blk = 1;
+
+    m->wcap = 2 * m->blk;
+
+    size_t ocap = nruns * m->wcap;
+
+    m->mem = PMR_MALLOC((nruns * (m->wcap + m->blk) + 2 * ocap) * sz);
+    m->pos = PMR_MALLOC((sizeof(size_t) * 4 + sizeof(void *) * 2 + sizeof(int)) * nruns);
+    m->io.ops = PMR_MALLOC(sizeof(extsort_op_t) * (nruns + 1));
+    if (m->mem == NULL || m->pos == NULL || m->io.ops == NULL)
+    {
+        PMR_FREE(m->io.ops);
+        PMR_FREE(m->pos);
+        PMR_FREE(m->mem);
+
+        errno = ENOMEM;
+        return -1;
+    }
+
+    /* windows of runs go at ascending addresses, so the order of runs is kept by k-way merge */
+    m->windows = m->mem;
+    m->ahead = _extsort_at(m->mem, nruns * m->wcap, sz);
+    m->outs[0] = _extsort_at(m->ahead, nruns * m->blk, sz);
+    m->outs[1] = _extsort_at(m->ahead, nruns * m->blk + ocap, sz);
+
+    m->len = m->pos + nruns;
+    m->alen = m->len + nruns;
+    m->aread = m->alen + nruns;
+    m->lo = (void **)(m->aread + nruns);
+    m->hi = m->lo + nruns;
+    m->tail = (int *)(m->hi + nruns);
+
+    for (size_t r = 0; r < nruns; r++)
+    {
+        m->len[r] = runs[r].n < m->blk ? runs[r].n : m->blk;
+        m->pos[r] = m->len[r];
+        m->alen[r] = 0;
+        m->aread[r] = 0;
+        m->tail[r] = m->pos[r] == runs[r].n;
+
+        m->left += runs[r].n;
+
+        _extsort_io_add(&m->io, fd, 0, _extsort_at(m->windows, r * m->wcap, sz), m->len[r] * sz, runs[r].off * (off_t)sz);
+    }
+
+    _extsort_io_start(&m->io);
+
+    if ((errno = _extsort_io_finish(&m->io)) != 0)
+        return -1;
+
+    return 0;
+}
+
+static void _extsort_merger_close(extsort_merger_t * m)
+{
+    PMR_FREE(m->io.ops);
+    PMR_FREE(m->pos);
+    PMR_FREE(m->mem);
+}
+
+/*
+ * merge the next output block (m->out, m->nout), the extra I/O (may be NULL) runs in background along with the read ahead;
+ * the previous output block stays intact
+ */
+static int _extsort_merger_step(extsort_merger_t * m, const extsort_op_t * extra)
+{
+    context_t * ctx = m->es->ctx;
+    size_t sz = ctx->sz;
+    size_t nruns = m->nruns;
+
+    for (size_t r = 0; r < nruns; r++)
+    {
+        m->lo[r] = _extsort_at(m->windows, r * m->wcap, sz);
+        m->hi[r] = _extsort_at(m->lo[r], m->len[r], sz);
+    }
+
+    size_t n = m->es->cut(ctx, m->lo, m->hi, m->tail, nruns);
+
+    if (extra != NULL)
+        m->io.ops[m->io.nops++] = *extra;
+
+    for (size_t r = 0; r < nruns; r++)
+    {
+        if (m->alen[r] != 0 || m->pos[r] == m->runs[r].n)
+            continue;
+
+        m->aread[r] = m->runs[r].n - m->pos[r] < m->blk ? m->runs[r].n - m->pos[r] : m->blk;
+
+        _extsort_io_add(&m->io, m->fd, 0, _extsort_at(m->ahead, r * m->blk, sz), m->aread[r] * sz,
+                        (m->runs[r].off + (off_t)m->pos[r]) * (off_t)sz);
+    }
+
+    _extsort_io_start(&m->io);
+
+    /* the windows are not adjacent, so the comparator is not probed on them */
+    context_t mctx = _ctx_sub(ctx, m->windows, n, NULL);
+    if (mctx.cost == 0)
+        mctx.cost = _PMR_CMP_COST_REF;
+
+    int rc = _extsort_rc(m->es->merge(&mctx, m->outs[m->k], m->lo, m->hi, nruns));
+    if (rc == 0)
+        rc = _extsort_rc(_cancelled(ctx, NULL));
+
+    int err = _extsort_io_finish(&m->io);
+    if (rc == 0 && err != 0)
+    {
+        errno = err;
+        rc = -1;
+    }
+
+    m->out = m->outs[m->k];
+    m->nout = n;
+    m->left -= n;
+    m->k ^= 1;
+
+    /* the rest of window goes to its start, then the block read ahead is appended if it fits */
+    for (size_t r = 0; r < nruns; r++)
+    {
+        size_t taken = (size_t)((char *)m->hi[r] - (char *)m->lo[r]) / sz;
+        m->len[r] -= taken;
+
+        if (m->len[r] != 0 && taken != 0)
+            PMR_MEMMOVE(m->lo[r], _extsort_at(m->lo[r], taken, sz), m->len[r] * sz);
+
+        if (m->aread[r] != 0)
+        {
+            m->alen[r] = m->aread[r];
+            m->pos[r] += m->aread[r];
+            m->aread[r] = 0;
+        }
+
+        if (m->alen[r] != 0 && m->len[r] + m->alen[r] <= m->wcap)
+        {
+            PMR_MEMCPY(_extsort_at(m->lo[r], m->len[r], sz), _extsort_at(m->ahead, r * m->blk, sz), m->alen[r] * sz);
+            m->len[r] += m->alen[r];
+            m->alen[r] = 0;
+        }
+
+        m->tail[r] = m->pos[r] == m->runs[r].n && m->alen[r] == 0;
+    }
+
+    return rc;
+}
+
+/*
+ * merge runs of fd to out at offset (in elements), the previous output block is written while the next one is merged
+ */
+static int _extsort_merge(extsort_t * es, int fd, const extsort_run_t * runs, size_t nruns, int out, off_t outoff)
+{
+    size_t sz = es->ctx->sz;
+
+    extsort_merger_t m;
+    int rc = _extsort_merger_open(&m, es, fd, runs, nruns);
+    if (rc != 0)
+        return rc;
+
+    extsort_op_t op = { out, 1, NULL, 0, 0 };
+
+    while (rc == 0 && m.left != 0)
+    {
+        rc = _extsort_merger_step(&m, op.len != 0 ? &op : NULL);
+
+        outoff += (off_t)(op.len / sz);
+
+        op.buf = m.out;
+        op.len = m.nout * sz;
+        op.off = outoff * (off_t)sz;
+    }
+
+    if (rc == 0 && op.len != 0)
+    {
+        _extsort_io_add(&m.io, out, 1, op.buf, op.len, op.off);
+        _extsort_io_start(&m.io);
+        if ((errno = _extsort_io_finish(&m.io)) != 0)
+            rc = -1;
+    }
+
+    _extsort_merger_close(&m);
+
+    return rc;
+}
+
+/*
+ * merge groups of fan-in runs to runs of the other temporary file until the runs fit one merge, the files are swapped
+ */
+static int _extsort_passes(extsort_t * es, int * tmp, int * tmp2, extsort_run_t * runs, size_t * nruns)
+{
+    /* the fan-in takes the min. blocks along with the overhead of merge */
+    size_t fixed = _extsort_overhead(es, 0);
+    size_t run = 7 * _PMR_EXTSORT_MIN_BLOCK + _extsort_overhead(es, 1) - fixed;
+
+    size_t fanin = es->budget > fixed ? (es->budget - fixed) / run : 0;
+    if (fanin < 2)
+        fanin = 2;
+
+    int rc = 0;
+    while (rc == 0 && *nruns > fanin)
+    {
+        if (*tmp2 < 0 && (*tmp2 = _extsort_tmpfile(es->tmpdir)) < 0)
+            return -1;
+
+        size_t m = 0;
+        for (size_t i = 0; i < *nruns && rc == 0; i += fanin, m++)
+        {
+            size_t k = *nruns - i < fanin ? *nruns - i : fanin;
+
+            extsort_run_t run = { runs[i].off, 0 };
+            for (size_t j = i; j < i + k; j++)
+                run.n += runs[j].n;
+
+            rc = _extsort_merge(es, *tmp, &runs[i], k, *tmp2, run.off);
+
+            runs[m] = run;
+        }
+
+        *nruns = m;
+
+        int t = *tmp;
+        *tmp = *tmp2;
+        *tmp2 = t;
+    }
+
+    return rc;
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+static int _extsort(extsort_t * es, const char * src, const char * dst)
+{
+    size_t sz = es->ctx->sz;
+
+    int fd = open(src, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        int err = errno;
+        (void)close(fd);
+        errno = err;
+        return -1;
+    }
+
+    if (!S_ISREG(st.st_mode) || (size_t)st.st_size % sz != 0)
+    {
+        (void)close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    _extsort_advise(fd);
+
+    size_t n = (size_t)st.st_size / sz;
+
+    /* 2 buffers of chunks and the scratch of pmergesort, that takes a chunk at most */
+    size_t chunk = es->budget / 3 / sz;
+    if (chunk == 0)
+        chunk = 1;
+
+    int rc = 0;
+    int out = -1;
+
+    if (n <= es->budget / sz)
+    {
+        /* fits the budget: read, sort and write, the output is opened after reading, so it may be the input; the sort is in
+           place if its scratch does not fit */
+        void * buf = PMR_MALLOC(n * sz + 1);
+        if (buf == NULL)
+        {
+            errno = ENOMEM;
+            rc = -1;
+        }
+
+        extsort_op_t op = { fd, 0, buf, n * sz, 0 };
+        if (rc == 0 && (errno = _extsort_pio(&op)) != 0)
+            rc = -1;
+
+        if (rc == 0)
+            rc = _extsort_sort(es, buf, n, n > es->budget / 2 / sz);
+
+        if (rc == 0 && (out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+            rc = -1;
+
+        op.fd = out;
+        op.wr = 1;
+        if (rc == 0 && (errno = _extsort_pio(&op)) != 0)
+            rc = -1;
+
+        PMR_FREE(buf);
+    }
+    else
+    {
+        size_t nruns = IDIV_UP(n, chunk);
+
+        extsort_run_t * runs = PMR_MALLOC(sizeof(extsort_run_t) * nruns);
+        int tmp = _extsort_tmpfile(es->tmpdir);
+        int tmp2 = -1;
+
+        if (runs == NULL)
+        {
+            errno = ENOMEM;
+            rc = -1;
+        }
+        else if (tmp < 0)
+            rc = -1;
+
+        if (rc == 0)
+            rc = _extsort_runs(es, fd, n, tmp, runs, nruns, chunk);
+
+        if (rc == 0)
+            rc = _extsort_passes(es, &tmp, &tmp2, runs, &nruns);
+
+        if (rc == 0 && (out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+            rc = -1;
+
+        if (rc == 0)
+            rc = _extsort_merge(es, tmp, runs, nruns, out, 0);
+
+        int err = errno;
+
+        if (tmp2 >= 0)
+            (void)close(tmp2);
+
+        if (tmp >= 0)
+            (void)close(tmp);
+
+        PMR_FREE(runs);
+
+        errno = err;
+    }
+
+    int err = errno;
+
+    if (out >= 0 && close(out) != 0 && rc == 0)
+    {
+        err = errno;
+        rc = -1;
+    }
+
+    (void)close(fd);
+
+    errno = err;
+
+    return rc;
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  in-place sort of mapped file                                                                                              */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+/*
+ * map file of n records for read and write, returns fd (base is NULL for empty file), or -1 with errno set
+ */
+static int _mapfile_open(const char * path, size_t sz, void ** base, size_t * n)
+{
+    int fd = open(path, O_RDWR);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        int err = errno;
+        (void)close(fd);
+        errno = err;
+        return -1;
+    }
+
+    if (!S_ISREG(st.st_mode) || (size_t)st.st_size % sz != 0)
+    {
+        (void)close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    *base = NULL;
+    *n = (size_t)st.st_size / sz;
+
+    if (*n == 0)
+        return fd;
+
+    void * p = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+    {
+        int err = errno;
+        (void)close(fd);
+        errno = err;
+        return -1;
+    }
+
+    /* the 1st pass goes through the whole file in order, so the file is read ahead in one sequential sweep; the merge passes
+       revisit pages, so no MADV_SEQUENTIAL that would drop them behind the sweep */
+#ifdef MADV_HUGEPAGE
+    (void)madvise(p, (size_t)st.st_size, MADV_HUGEPAGE);
+#endif
+    (void)madvise(p, (size_t)st.st_size, MADV_WILLNEED);
+
+    *base = p;
+
+    return fd;
+}
+
+/*
+ * the file is sorted in place with PMR_INPLACE flag, or if the scratch of pmergesort (a file at most) would exceed the budget
+ */
+static inline int _mapfile_inplace(size_t n, size_t sz, const pmr_options_t * opts)
+{
+    size_t budget = opts != NULL && opts->mem_budget != 0 ? opts->mem_budget : _PMR_EXTSORT_BUDGET;
+
+    return (opts != NULL && (opts->flags & PMR_INPLACE) != 0) || n > budget / sz;
+}
+
+/*
+ * flush and unmap file, returns rc of sort, or -1 with errno set if flush failed
+ */
+static int _mapfile_close(int fd, void * base, size_t len, int rc)
+{
+    int err = errno;
+
+    if (base != NULL)
+    {
+        if (msync(base, len, MS_SYNC) != 0 && rc == 0)
+        {
+            err = errno;
+            rc = -1;
+        }
+
+        (void)munmap(base, len);
+    }
+
+    (void)close(fd);
+
+    errno = err;
+
+    return rc;
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
@@ -0,0 +1,454 @@
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  pmergesort-keys.inl                                                                                                       */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  Created by Cyril Murzin                                                                                                   */
+/*  Copyright (c) 2015-2017 Ravel Developers Group. All rights reserved.                                                      */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  compiled multi-column key specifications                                                                                  */
+/*                                                                                                                            */
+/*  the spec is compiled to the comparator specialized by shape: a single integer column is compared with no loop and no      */
+/*  switch, the leading integer column of several ones is compared inline and only its ties go to the loop over the rest of   */
+/*  columns; the spec is the thunk of comparator, so it runs in every search and merge loop of reentrant sorts                */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+#define _PMR_KEY_INT_TYPES(X) \
+    X(I8, int8_t) X(I16, int16_t) X(I32, int32_t) X(I64, int64_t) X(U8, uint8_t) X(U16, uint16_t) X(U32, uint32_t) X(U64, uint64_t)
+
+struct _key_op
+{
+    size_t          offset;     /* offset of column in element */
+    unsigned int    type;       /* PMR_KEY_xxx */
+    int             dir;        /* 1 for ascending, -1 for descending */
+    int             nulls;      /* order of null to non-null: -1 for nulls first, 1 for nulls last */
+};
+typedef struct _key_op key_op_t;
+
+struct pmr_keyspec
+{
+    cmpr_t          cmp;        /* compiled comparator, the spec is its thunk */
+    size_t          nkeys;
+    key_op_t        keys[];
+};
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+#define _PMR_KEY_LOAD(T, x, p)  T x; memcpy(&x, (p), sizeof(T)) /* columns may be unaligned */
+
+static inline int _key_field(const key_op_t * op, const void * a, const void * b)
+{
+    const char * pa = (const char *)a + op->offset;
+    const char * pb = (const char *)b + op->offset;
+
+    switch (op->type)
+    {
+#define _PMR_KEY_CASE(NAME, T) \
+    case PMR_KEY_##NAME: \
+    { \
+        _PMR_KEY_LOAD(T, x, pa); \
+        _PMR_KEY_LOAD(T, y, pb); \
+        return op->dir * ((x > y) - (x < y)); \
+    }
+    _PMR_KEY_INT_TYPES(_PMR_KEY_CASE)
+#undef _PMR_KEY_CASE
+
+    case PMR_KEY_F32:
+    {
+        _PMR_KEY_LOAD(float, x, pa);
+        _PMR_KEY_LOAD(float, y, pb);
+
+        int nx = x != x;
+        int ny = y != y;
+        if (nx | ny)
+            return nx == ny ? 0 : (nx ? op->nulls : -op->nulls);
+
+        return op->dir * ((x > y) - (x < y));
+    }
+
+    case PMR_KEY_F64:
+    {
+        _PMR_KEY_LOAD(double, x, pa);
+        _PMR_KEY_LOAD(double, y, pb);
+
+        int nx = x != x;
+        int ny = y != y;
+        if (nx | ny)
+            return nx == ny ? 0 : (nx ? op->nulls : -op->nulls);
+
+        return op->dir * ((x > y) - (x < y));
+    }
+
+    default: /* PMR_KEY_STR */
+    {
+        _PMR_KEY_LOAD(const char *, x, pa);
+        _PMR_KEY_LOAD(const char *, y, pb);
+
+        if (x == NULL || y == NULL)
+            return x == y ? 0 : (x == NULL ? op->nulls : -op->nulls);
+
+        int rc = strcmp(x, y);
+
+        return op->dir * ((rc > 0) - (rc < 0));
+    }
+    }
+}
+
+static inline int _keys_from(const pmr_keyspec_t * spec, size_t i, const void * a, const void * b)
+{
+    for (; i < spec->nkeys; i++)
+    {
+        int rc = _key_field(&spec->keys[i], a, b);
+        if (rc != 0)
+            return rc;
+    }
+
+    return 0;
+}
+
+static int _keys_any(void * thunk, const void * a, const void * b)
+{
+    return _keys_from(thunk, 0, a, b);
+}
+
+/*
+ * single integer column, and leading integer column of several ones
+ */
+#define _PMR_KEY_SPECIALIZE(NAME, T) \
+static int _keys1_##NAME##_asc(void * thunk, const void * a, const void * b) \
+{ \
+    size_t off = ((const pmr_keyspec_t *)thunk)->keys[0].offset; \
+    _PMR_KEY_LOAD(T, x, (const char *)a + off); \
+    _PMR_KEY_LOAD(T, y, (const char *)b + off); \
+    return (x > y) - (x < y); \
+} \
+static int _keys1_##NAME##_desc(void * thunk, const void * a, const void * b) \
+{ \
+    size_t off = ((const pmr_keyspec_t *)thunk)->keys[0].offset; \
+    _PMR_KEY_LOAD(T, x, (const char *)a + off); \
+    _PMR_KEY_LOAD(T, y, (const char *)b + off); \
+    return (x < y) - (x > y); \
+} \
+static int _keysn_##NAME##_asc(void * thunk, const void * a, const void * b) \
+{ \
+    size_t off = ((const pmr_keyspec_t *)thunk)->keys[0].offset; \
+    _PMR_KEY_LOAD(T, x, (const char *)a + off); \
+    _PMR_KEY_LOAD(T, y, (const char *)b + off); \
+    return x != y ? (x > y) - (x < y) : _keys_from(thunk, 1, a, b); \
+} \
+static int _keysn_##NAME##_desc(void * thunk, const void * a, const void * b) \
+{ \
+    size_t off = ((const pmr_keyspec_t *)thunk)->keys[0].offset; \
+    _PMR_KEY_LOAD(T, x, (const char *)a + off); \
+    _PMR_KEY_LOAD(T, y, (const char *)b + off); \
+    return x != y ? (x < y) - (x > y) : _keys_from(thunk, 1, a, b); \
+}
+_PMR_KEY_INT_TYPES(_PMR_KEY_SPECIALIZE)
+#undef _PMR_KEY_SPECIALIZE
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+/*
+ * compile spec, returns NULL with errno set on failure
+ */
+static pmr_keyspec_t * _keyspec_compile(const pmr_key_t * keys, size_t nkeys)
+{
+    if (keys == NULL || nkeys == 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    for (size_t i = 0; i < nkeys; i++)
+    {
+        if (keys[i].type < PMR_KEY_I8 || keys[i].type > PMR_KEY_STR || (keys[i].flags & ~(PMR_KEY_DESC | PMR_KEY_NULLS_FIRST)) != 0)
+        {
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+
+    pmr_keyspec_t * spec = PMR_MALLOC(sizeof(pmr_keyspec_t) + sizeof(key_op_t) * nkeys);
+    if (spec == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    spec->nkeys = nkeys;
+
+    for (size_t i = 0; i < nkeys; i++)
+    {
+        spec->keys[i].offset = keys[i].offset;
+        spec->keys[i].type = keys[i].type;
+        spec->keys[i].dir = (keys[i].flags & PMR_KEY_DESC) != 0 ? -1 : 1;
+        spec->keys[i].nulls = (keys[i].flags & PMR_KEY_NULLS_FIRST) != 0 ? -1 : 1;
+    }
+
+    int desc = spec->keys[0].dir < 0;
+
+    switch (spec->keys[0].type)
+    {
+#define _PMR_KEY_PICK(NAME, T) \
+    case PMR_KEY_##NAME: \
+        spec->cmp = nkeys == 1 ? (desc ? _keys1_##NAME##_desc : _keys1_##NAME##_asc) : (desc ? _keysn_##NAME##_desc : _keysn_##NAME##_asc); \
+        break;
+    _PMR_KEY_INT_TYPES(_PMR_KEY_PICK)
+#undef _PMR_KEY_PICK
+
+    default:
+        spec->cmp = _keys_any;
+        break;
+    }
+
+    return spec;
+}
+
+#undef _PMR_KEY_LOAD
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  cached key prefixes of pointer arrays                                                                                     */
+/*                                                                                                                            */
+/*  the array of pointers to records is sorted as array of (prefix, pointer) pairs of 16 bytes, so the merge loops run on     */
+/*  the specialized moves of 16 byte elements, and compare the inline prefixes with no dereference of records; only ties of   */
+/*  prefixes dereference the pointers to call the full comparator. the pairs are built and the pointers are written back      */
+/*  in parallel chunks                                                                                                        */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+struct _prefix_pair
+{
+    uint64_t            prefix;
+    const void *        ptr;
+} __attribute__((aligned(16)));
+typedef struct _prefix_pair prefix_pair_t;
+
+struct _prefix_sort
+{
+    void **             base;
+    prefix_pair_t *     pairs;
+    size_t              n;
+    size_t              nchunks;
+    void *              thunk;
+    cmpr_t              cmp;        /* full comparator of records */
+    uint64_t            (*prefix)(void *, const void *);
+};
+typedef struct _prefix_sort prefix_sort_t;
+
+static int _prefix_cmp(void * thunk, const void * a, const void * b)
+{
+    const prefix_pair_t * x = a;
+    const prefix_pair_t * y = b;
+
+    if (x->prefix != y->prefix)
+        return x->prefix < y->prefix ? -1 : 1;
+
+    const prefix_sort_t * ps = thunk;
+
+    return ps->cmp(ps->thunk, x->ptr, y->ptr);
+}
+
+/*
+ * comparator of pairs inlined to the dedicated instantiation of pmergesort_prefix, the thunk of context is the prefix sort
+ */
+static inline int _prefix_pair_cmp(const context_t * ctx, const void * a, const void * b)
+{
+    const prefix_pair_t * x = a;
+    const prefix_pair_t * y = b;
+
+    if (__builtin_expect(x->prefix != y->prefix, 1))
+        return x->prefix < y->prefix ? -1 : 1;
+
+    const prefix_sort_t * ps = ctx->thunk;
+
+    return ps->cmp(ps->thunk, x->ptr, y->ptr);
+}
+
+static void _prefix_fill(void * arg, size_t i)
+{
+    prefix_sort_t * ps = arg;
+
+    size_t lo = ps->n * i / ps->nchunks;
+    size_t hi = ps->n * (i + 1) / ps->nchunks;
+
+    for (size_t k = lo; k < hi; k++)
+    {
+        ps->pairs[k].prefix = ps->prefix(ps->thunk, ps->base[k]);
+        ps->pairs[k].ptr = ps->base[k];
+    }
+}
+
+static void _prefix_store(void * arg, size_t i)
+{
+    prefix_sort_t * ps = arg;
+
+    size_t lo = ps->n * i / ps->nchunks;
+    size_t hi = ps->n * (i + 1) / ps->nchunks;
+
+    for (size_t k = lo; k < hi; k++)
+        ps->base[k] = (void *)ps->pairs[k].ptr;
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  sort by key with satellite columns                                                                                        */
+/*                                                                                                                            */
+/*  the keys are sorted as records of key padded to word and its original index, the comparator of keys runs on the records   */
+/*  as is since the key is at the start of record; then the keys are written back and every payload column is gathered by    */
+/*  the indices to temporary column and copied back, each step in parallel chunks, so no element of payload moves more than   */
+/*  twice whatever the width of row is                                                                                        */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+struct _bykey
+{
+    char *              keys;
+    size_t              n;
+    size_t              key_sz;
+    size_t              rsz;        /* size of record, the index is at rsz - sizeof(size_t) */
+    char *              recs;
+    size_t              nchunks;
+
+    char *              col;        /* payload column being gathered */
+    size_t              psz;
+    char *              tmp;
+};
+typedef struct _bykey bykey_t;
+
+#define _PMR_BYKEY_IDX(bk, k)   (*(size_t *)((bk)->recs + (k) * (bk)->rsz + (bk)->rsz - sizeof(size_t)))
+
+static void _bykey_fill(void * arg, size_t i)
+{
+    bykey_t * bk = arg;
+
+    size_t lo = bk->n * i / bk->nchunks;
+    size_t hi = bk->n * (i + 1) / bk->nchunks;
+
+    for (size_t k = lo; k < hi; k++)
+    {
+        PMR_MEMCPY(bk->recs + k * bk->rsz, bk->keys + k * bk->key_sz, bk->key_sz);
+        _PMR_BYKEY_IDX(bk, k) = k;
+    }
+}
+
+static void _bykey_store(void * arg, size_t i)
+{
+    bykey_t * bk = arg;
+
+    size_t lo = bk->n * i / bk->nchunks;
+    size_t hi = bk->n * (i + 1) / bk->nchunks;
+
+    for (size_t k = lo; k < hi; k++)
+        PMR_MEMCPY(bk->keys + k * bk->key_sz, bk->recs + k * bk->rsz, bk->key_sz);
+}
+
+static void _bykey_gather(void * arg, size_t i)
+{
+    bykey_t * bk = arg;
+
+    size_t lo = bk->n * i / bk->nchunks;
+    size_t hi = bk->n * (i + 1) / bk->nchunks;
+
+    switch (bk->psz)
+    {
+#if PMR_RAW_ACCESS
+    case 4:
+        for (size_t k = lo; k < hi; k++)
+            ((uint32_t *)bk->tmp)[k] = ((const uint32_t *)bk->col)[_PMR_BYKEY_IDX(bk, k)];
+        break;
+
+    case 8:
+        for (size_t k = lo; k < hi; k++)
+            ((uint64_t *)bk->tmp)[k] = ((const uint64_t *)bk->col)[_PMR_BYKEY_IDX(bk, k)];
+        break;
+#endif
+
+    default:
+        for (size_t k = lo; k < hi; k++)
+            PMR_MEMCPY(bk->tmp + k * bk->psz, bk->col + _PMR_BYKEY_IDX(bk, k) * bk->psz, bk->psz);
+        break;
+    }
+}
+
+static void _bykey_scatter(void * arg, size_t i)
+{
+    bykey_t * bk = arg;
+
+    size_t lo = bk->n * i / bk->nchunks;
+    size_t hi = bk->n * (i + 1) / bk->nchunks;
+
+    PMR_MEMCPY(bk->col + lo * bk->psz, bk->tmp + lo * bk->psz, (hi - lo) * bk->psz);
+}
+
+#undef _PMR_BYKEY_IDX
+
+/*
+ * allocate and fill records of keys, returns non-zero on failure
+ */
+static int _bykey_open(bykey_t * bk, void * keys, size_t n, size_t key_sz)
+{
+    bk->keys = keys;
+    bk->n = n;
+    bk->key_sz = key_sz;
+    bk->rsz = (key_sz + sizeof(size_t) - 1) / sizeof(size_t) * sizeof(size_t) + sizeof(size_t);
+    bk->col = NULL;
+    bk->psz = 0;
+    bk->tmp = NULL;
+
+#if _PMR_PARALLEL_MAY_SPAWN
+    int nchunks = scaleCPU(n, numCPU(), _PMR_PARALLEL_GRAIN);
+    bk->nchunks = nchunks > 1 ? (size_t)nchunks : 1;
+#else
+    bk->nchunks = 1;
+#endif
+
+    bk->recs = PMR_MALLOC(bk->rsz * n);
+    if (bk->recs == NULL)
+        return 1;
+
+    pmergesort_apply(bk->nchunks, _bykey_fill, bk);
+
+    return 0;
+}
+
+/*
+ * write back sorted keys and permute payload columns, returns non-zero on failure
+ */
+static int _bykey_close(bykey_t * bk, void * const * payloads, const size_t * payload_sz, size_t npayloads)
+{
+    size_t psz = 0;
+    for (size_t c = 0; c < npayloads; c++)
+        psz = payload_sz[c] > psz ? payload_sz[c] : psz;
+
+    if (psz > 0)
+    {
+        bk->tmp = PMR_MALLOC(psz * bk->n);
+        if (bk->tmp == NULL)
+        {
+            PMR_FREE(bk->recs);
+            return 1; /* keys and payloads are left intact */
+        }
+    }
+
+    pmergesort_apply(bk->nchunks, _bykey_store, bk);
+
+    for (size_t c = 0; c < npayloads; c++)
+    {
+        if (payload_sz[c] == 0)
+            continue;
+
+        bk->col = payloads[c];
+        bk->psz = payload_sz[c];
+
+        pmergesort_apply(bk->nchunks, _bykey_gather, bk);
+        pmergesort_apply(bk->nchunks, _bykey_scatter, bk);
+    }
+
+    PMR_FREE(bk->tmp);
+    PMR_FREE(bk->recs);
+
+    return 0;
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
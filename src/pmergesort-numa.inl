@@ -0,0 +1,205 @@
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  pmergesort-numa.inl                                                                                                       */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  Created by Cyril Murzin                                                                                                   */
+/*  Copyright (c) 2015-2017 Ravel Developers Group. All rights reserved.                                                      */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  NUMA placement of chunks and temporary storage (Linux, no libnuma dependency)                                             */
+/*                                                                                                                            */
+/*  the home node of a chunk is the node holding the 1st page of chunk, so chunk-to-node assignment follows the data and      */
+/*  stays the same across passes; the worker processing the chunk is bound to CPUs of the home node for the duration of       */
+/*  the job, and its temporary storage is allocated on the home node                                                          */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/* see <numaif.h> */
+#define _PMR_MPOL_PREFERRED         1
+#define _PMR_MPOL_F_NODE            (1 << 0)
+#define _PMR_MPOL_F_ADDR            (1 << 1)
+
+#define _PMR_NUMA_MAX_NODES         64  /* nodemask fits unsigned long */
+
+struct _numa
+{
+    int             nnodes;                         /* number of nodes, 0 if NUMA is not available  */
+    cpu_set_t       cpus[_PMR_NUMA_MAX_NODES];      /* CPUs of node                                 */
+};
+typedef struct _numa numa_t;
+
+struct _numa_scope
+{
+    int             node;       /* home node, or -1 if thread is not bound */
+    cpu_set_t       saved;      /* affinity of thread to restore */
+};
+typedef struct _numa_scope numa_scope_t;
+
+static numa_t _numa;
+
+/*
+ * parse sysfs CPU list of the "0-3,8-11" form
+ */
+static int __numa_cpulist(const char * path, cpu_set_t * set)
+{
+    FILE * f = fopen(path, "r");
+    if (f == NULL)
+        return 0;
+
+    CPU_ZERO(set);
+
+    int n = 0;
+    int lo, hi;
+    while (fscanf(f, "%d", &lo) == 1)
+    {
+        hi = lo;
+
+        int c = fgetc(f);
+        if (c == '-')
+        {
+            if (fscanf(f, "%d", &hi) != 1)
+                break;
+
+            c = fgetc(f);
+        }
+
+        for (int cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; cpu++, n++)
+            CPU_SET(cpu, set);
+
+        if (c != ',')
+            break;
+    }
+
+    fclose(f);
+
+    return n;
+}
+
+static void __numa_initialize()
+{
+    char path[128];
+
+    int nnodes = 0;
+    for (int node = 0; node < _PMR_NUMA_MAX_NODES; node++)
+    {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+        if (__numa_cpulist(path, &_numa.cpus[node]) > 0)
+            nnodes = node + 1;
+        else
+            CPU_ZERO(&_numa.cpus[node]); /* absent or memory only node */
+    }
+
+    _numa.nnodes = nnodes > 1 ? nnodes : 0; /* nothing to do on single node */
+}
+
+static int numaNodes()
+{
+static pthread_once_t _once = PTHREAD_ONCE_INIT;
+
+    pthread_once(&_once, __numa_initialize);
+
+    return _numa.nnodes;
+}
+
+/*
+ * node holding the page of address, or -1
+ */
+static inline int _numa_node_of_addr(const void * addr)
+{
+    int node = -1;
+    if (syscall(SYS_get_mempolicy, &node, NULL, 0UL, addr, (unsigned long)(_PMR_MPOL_F_NODE | _PMR_MPOL_F_ADDR)) != 0)
+        return -1;
+
+    return node < _numa.nnodes ? node : -1;
+}
+
+/*
+ * node of CPU the calling thread runs on, or -1
+ */
+static inline int _numa_node_of_self()
+{
+    int cpu = sched_getcpu();
+    if (cpu < 0)
+        return -1;
+
+    for (int node = 0; node < _numa.nnodes; node++)
+    {
+        if (CPU_ISSET(cpu, &_numa.cpus[node]))
+            return node;
+    }
+
+    return -1;
+}
+
+/*
+ * allocate temporary storage preferably at node
+ */
+static inline void * _numa_alloc(size_t sz, int node)
+{
+    void * p = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    /* pages are not touched yet, so placement applies to all of them; the kernel reads maxnode - 1 bits of mask */
+    unsigned long mask;
+    if (node >= 0 && node < (int)(sizeof(mask) * 8))
+    {
+        mask = 1UL << node;
+        (void)syscall(SYS_mbind, p, sz, _PMR_MPOL_PREFERRED, &mask, (unsigned long)(sizeof(mask) * 8 + 1), 0U);
+    }
+
+    return p;
+}
+
+static inline void _numa_free(void * p, size_t sz)
+{
+    (void)munmap(p, sz);
+}
+
+/*
+ * bind calling thread to the home node of chunk at lo, returns home node or -1
+ */
+static inline int _numa_enter(numa_scope_t * scope, const void * lo, size_t nbytes)
+{
+    scope->node = -1;
+
+    if (numaNodes() == 0)
+        return -1;
+
+    int node = _numa_node_of_addr(lo);
+    if (node < 0 || CPU_COUNT(&_numa.cpus[node]) == 0)
+        return -1;
+
+#if _PMR_CORE_PROFILE
+    /* traffic is accounted by the node the worker dequeued the chunk at, before it is bound */
+    if (_numa_node_of_self() == node)
+        (void)__sync_fetch_and_add(&_stats.numa_local_bytes, nbytes);
+    else
+        (void)__sync_fetch_and_add(&_stats.numa_remote_bytes, nbytes);
+#else
+    (void)nbytes;
+#endif
+
+    if (sched_getaffinity(0, sizeof(scope->saved), &scope->saved) == 0
+            && sched_setaffinity(0, sizeof(_numa.cpus[node]), &_numa.cpus[node]) == 0)
+        scope->node = node;
+#if _PMR_CORE_PROFILE
+    else
+        (void)__sync_fetch_and_add(&_stats.numa_unbound_bytes, nbytes);
+#endif
+
+    return node;
+}
+
+static inline void _numa_leave(numa_scope_t * scope)
+{
+    if (scope->node >= 0)
+        (void)sched_setaffinity(0, sizeof(scope->saved), &scope->saved);
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
@@ -26,6 +26,20 @@ extern "C" {
     /* hacks for profiling purposes                                                                                           */
     /* ---------------------------------------------------------------------------------------------------------------------- */
     void pmergesort_nCPU(int32_t ncpu);
+
+    typedef struct pmergesort_stats
+    {
+        size_t  jobs_allocated;     /* thread pool job descriptors obtained from allocator      */
+        size_t  jobs_reused;        /* thread pool job descriptors taken from free list         */
+        size_t  spawns_allocated;   /* slab blocks of spawn descriptors obtained from allocator */
+        size_t  spawns_reused;      /* spawn descriptors taken from free list                   */
+        size_t  numa_local_bytes;   /* bytes of chunks dequeued by worker at their home node    */
+        size_t  numa_remote_bytes;  /* bytes of chunks dequeued by worker at other NUMA node    */
+        size_t  numa_unbound_bytes; /* bytes of those processed across nodes (binding failed)  */
+    } pmergesort_stats_t;
+
+    void pmergesort_stats(pmergesort_stats_t * stats);
+    void pmergesort_stats_reset(void);
     /* ---------------------------------------------------------------------------------------------------------------------- */
 
 #ifdef __cplusplus
@@ -0,0 +1,321 @@
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  pmergesort-str.inl                                                                                                        */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  Created by Cyril Murzin                                                                                                   */
+/*  Copyright (c) 2015-2017 Ravel Developers Group. All rights reserved.                                                      */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  LCP-aware merge sort of strings                                                                                           */
+/*                                                                                                                            */
+/*  every sorted run carries the length of the longest common prefix of each string with the previous one; the merge keeps   */
+/*  for the heads of both runs their LCP with the last string written: the head of larger LCP is the less one with no         */
+/*  comparison, and on equal LCP the strings are compared from it, so no character of shared prefix is scanned twice         */
+/*                                                                                                                            */
+/*  the passes are the ones of pmergesort: a chunk per thread is sorted by the sequential LCP merge sort, then the runs are   */
+/*  merged pairwise, and the merge of pair is split at output coranks into parts, so every pass has work for every thread;    */
+/*  the LCP of the 1st string of part is computed against the last string of previous part                                   */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+#define _PMR_STR_SMALL              16  /* run length to sort by insertion */
+
+struct _str_buf
+{
+    const char **       s;
+    size_t *            lcp;
+};
+typedef struct _str_buf str_buf_t;
+
+struct _str_part
+{
+    size_t              a, na;      /* 1st run is [a, a + na) of source */
+    size_t              b, nb;      /* 2nd run is [b, b + nb) of source */
+    size_t              d;          /* output is [d, d + na + nb) of destination */
+    size_t              ha, hb;     /* LCP of heads with the last string written before the part */
+};
+typedef struct _str_part str_part_t;
+
+struct _str_pass
+{
+    str_buf_t           bufs[2];
+    int                 src;        /* buffer of runs being merged */
+    size_t              n;
+    size_t              nchunks;    /* 1st pass: number of chunks */
+    int                 to;         /* 1st pass: buffer of sorted chunks */
+    str_part_t *        parts;      /* merge passes: parts of merges */
+};
+typedef struct _str_pass str_pass_t;
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+static inline size_t _str_lcp(const char * a, const char * b, size_t h)
+{
+    while (a[h] != 0 && a[h] == b[h])
+        h++;
+
+    return h;
+}
+
+static inline int _str_cmp(const char * a, const char * b)
+{
+    size_t h = _str_lcp(a, b, 0);
+
+    return (int)(unsigned char)a[h] - (int)(unsigned char)b[h];
+}
+
+/*
+ * stable LCP merge of runs a and b into d, ha and hb are LCP of heads with the string written before d
+ */
+static void _str_merge(const char ** a, const size_t * la, size_t na,
+                        const char ** b, const size_t * lb, size_t nb,
+                        const char ** d, size_t * ld, size_t ha, size_t hb)
+{
+    size_t i = 0;
+    size_t j = 0;
+
+    while (i < na && j < nb)
+    {
+        if (ha > hb)
+        {
+            *d++ = a[i]; *ld++ = ha;
+            if (++i < na)
+                ha = la[i];
+        }
+        else if (ha < hb)
+        {
+            *d++ = b[j]; *ld++ = hb;
+            if (++j < nb)
+                hb = lb[j];
+        }
+        else
+        {
+            size_t h = _str_lcp(a[i], b[j], ha);
+
+            if ((unsigned char)a[i][h] <= (unsigned char)b[j][h])
+            {
+                *d++ = a[i]; *ld++ = ha;
+                hb = h;
+                if (++i < na)
+                    ha = la[i];
+            }
+            else
+            {
+                *d++ = b[j]; *ld++ = hb;
+                ha = h;
+                if (++j < nb)
+                    hb = lb[j];
+            }
+        }
+    }
+
+    if (i < na)
+    {
+        *d++ = a[i]; *ld++ = ha;
+        PMR_MEMCPY(d, a + i + 1, sizeof(const char *) * (na - i - 1));
+        PMR_MEMCPY(ld, la + i + 1, sizeof(size_t) * (na - i - 1));
+    }
+    else if (j < nb)
+    {
+        *d++ = b[j]; *ld++ = hb;
+        PMR_MEMCPY(d, b + j + 1, sizeof(const char *) * (nb - j - 1));
+        PMR_MEMCPY(ld, lb + j + 1, sizeof(size_t) * (nb - j - 1));
+    }
+}
+
+/*
+ * sequential LCP merge sort of [lo, lo + n), the result goes to buffer to, the other one is temporary
+ */
+static void _str_msort(str_buf_t * bufs, size_t lo, size_t n, int to)
+{
+    if (n <= _PMR_STR_SMALL)
+    {
+        const char ** s = bufs[0].s + lo;
+
+        for (size_t i = 1; i < n; i++)
+        {
+            const char * x = s[i];
+            size_t j = i;
+
+            for (; j > 0 && _str_cmp(s[j - 1], x) > 0; j--)
+                s[j] = s[j - 1];
+
+            s[j] = x;
+        }
+
+        const char ** d = bufs[to].s + lo;
+        size_t * ld = bufs[to].lcp + lo;
+
+        if (d != s)
+            PMR_MEMCPY(d, s, sizeof(const char *) * n);
+
+        ld[0] = 0;
+        for (size_t i = 1; i < n; i++)
+            ld[i] = _str_lcp(d[i - 1], d[i], 0);
+
+        return;
+    }
+
+    size_t h = n >> 1;
+
+    _str_msort(bufs, lo, h, !to);
+    _str_msort(bufs, lo + h, n - h, !to);
+
+    str_buf_t * s = &bufs[!to];
+
+    _str_merge(s->s + lo, s->lcp + lo, h, s->s + lo + h, s->lcp + lo + h, n - h, bufs[to].s + lo, bufs[to].lcp + lo, 0, 0);
+}
+
+/*
+ * number of elements of a taken by the 1st k of stable merge of a and b
+ */
+static size_t _str_corank(const char ** a, size_t na, const char ** b, size_t nb, size_t k)
+{
+    size_t lo = k > nb ? k - nb : 0;
+    size_t hi = k < na ? k : na;
+
+    while (lo < hi)
+    {
+        size_t i = lo + ((hi - lo) >> 1);
+
+        if (_str_cmp(a[i], b[k - i - 1]) <= 0)
+            lo = i + 1;
+        else
+            hi = i;
+    }
+
+    return lo;
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+static void _str_chunk(void * arg, size_t i)
+{
+    str_pass_t * pass = arg;
+
+    size_t lo = pass->n * i / pass->nchunks;
+    size_t hi = pass->n * (i + 1) / pass->nchunks;
+
+    _str_msort(pass->bufs, lo, hi - lo, pass->to);
+}
+
+static void _str_part(void * arg, size_t i)
+{
+    str_pass_t * pass = arg;
+    str_part_t * p = &pass->parts[i];
+    str_buf_t * s = &pass->bufs[pass->src];
+    str_buf_t * d = &pass->bufs[!pass->src];
+
+    _str_merge(s->s + p->a, s->lcp + p->a, p->na, s->s + p->b, s->lcp + p->b, p->nb, d->s + p->d, d->lcp + p->d, p->ha, p->hb);
+}
+
+/*
+ * part of merge of runs [a, b) and [b, e) starting at output corank k of it
+ */
+static void _str_split(const str_buf_t * s, size_t a, size_t b, size_t e, size_t k, size_t kk, str_part_t * p)
+{
+    size_t na = b - a;
+    size_t nb = e - b;
+
+    size_t i = _str_corank(s->s + a, na, s->s + b, nb, k);
+    size_t j = k - i;
+    size_t ii = _str_corank(s->s + a, na, s->s + b, nb, kk);
+    size_t jj = kk - ii;
+
+    p->a = a + i;
+    p->na = ii - i;
+    p->b = b + j;
+    p->nb = jj - j;
+    p->d = a + k;
+    p->ha = 0;
+    p->hb = 0;
+
+    if (k == 0)
+        return;
+
+    /* the last string written before the part is the greater one of preceding ones */
+    const char * last = i == 0 ? s->s[b + j - 1] : (j == 0 ? s->s[a + i - 1] :
+        (_str_cmp(s->s[a + i - 1], s->s[b + j - 1]) > 0 ? s->s[a + i - 1] : s->s[b + j - 1]));
+
+    if (p->na > 0)
+        p->ha = _str_lcp(last, s->s[p->a], 0);
+    if (p->nb > 0)
+        p->hb = _str_lcp(last, s->s[p->b], 0);
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+static int _str_sort(const char ** base, size_t n)
+{
+#if _PMR_PARALLEL_MAY_SPAWN
+    size_t nchunks = (size_t)scaleCPU(n, numCPU(), _PMR_PARALLEL_GRAIN);
+    if (nchunks < 1)
+        nchunks = 1;
+#else
+    size_t nchunks = 1;
+#endif
+
+    int npasses = 0;
+    for (size_t r = nchunks; r > 1; r = (r + 1) >> 1)
+        npasses++;
+
+    void * tmp = PMR_MALLOC((sizeof(const char *) + 2 * sizeof(size_t)) * n + sizeof(str_part_t) * 2 * nchunks);
+    if (tmp == NULL)
+        return 1;
+
+    str_pass_t pass;
+
+    pass.bufs[0].s = base;
+    pass.bufs[0].lcp = tmp;
+    pass.bufs[1].lcp = pass.bufs[0].lcp + n;
+    pass.bufs[1].s = (const char **)(pass.bufs[1].lcp + n);
+    pass.parts = (str_part_t *)(pass.bufs[1].s + n);
+    pass.n = n;
+    pass.nchunks = nchunks;
+    pass.to = npasses & 1; /* every merge pass flips buffers, the last one lands in base */
+
+    pmergesort_apply(nchunks, _str_chunk, &pass);
+
+    pass.src = pass.to;
+
+    for (size_t nruns = nchunks, shift = 0; nruns > 1; nruns = (nruns + 1) >> 1, shift++)
+    {
+        size_t nmerges = nruns >> 1;
+        size_t per = (nchunks + nmerges - 1) / nmerges; /* parts per merge */
+        size_t nparts = 0;
+        str_buf_t * s = &pass.bufs[pass.src];
+
+        /* run r of pass is chunks [r << shift, (r + 1) << shift) */
+#define _PMR_STR_RUN(r) (n * ((r) << shift < nchunks ? (r) << shift : nchunks) / nchunks)
+
+        for (size_t m = 0; m < nmerges; m++)
+        {
+            size_t a = _PMR_STR_RUN(2 * m);
+            size_t b = _PMR_STR_RUN(2 * m + 1);
+            size_t e = _PMR_STR_RUN(2 * m + 2);
+
+            for (size_t q = 0; q < per; q++)
+                _str_split(s, a, b, e, (e - a) * q / per, (e - a) * (q + 1) / per, &pass.parts[nparts++]);
+        }
+
+        if (nruns & 1) /* odd run is just moved on */
+        {
+            size_t a = _PMR_STR_RUN(nruns - 1);
+
+            pass.parts[nparts++] = (str_part_t){ a, n - a, n, 0, a, 0, 0 };
+        }
+
+#undef _PMR_STR_RUN
+
+        pmergesort_apply(nparts, _str_part, &pass);
+
+        pass.src = !pass.src;
+    }
+
+    PMR_FREE(tmp);
+
+    return 0;
+}
+
+#undef _PMR_STR_SMALL
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
@@ -0,0 +1,542 @@
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  pmergesort-stream.inl                                                                                                     */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  Created by Cyril Murzin                                                                                                   */
+/*  Copyright (c) 2015-2017 Ravel Developers Group. All rights reserved.                                                      */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  push-based streaming sort                                                                                                 */
+/*                                                                                                                            */
+/*  pushed elements fill one of 2 buffers, the full buffer is sorted by asynchronous pmergesort while the other one is        */
+/*  filled; sorted batches feed the run generation by replacement selection of batches: the reservoir holds the sorted        */
+/*  elements of the current run not written yet, the elements of batch less than the last written one go to the next run,    */
+/*  the rest are merged into reservoir, and the least elements of reservoir are written to the run while reservoir and the    */
+/*  next run exceed the limit; the run ends when reservoir is exhausted, so runs are about twice as long as the limit on      */
+/*  random input, and presorted input makes a single run                                                                      */
+/*                                                                                                                            */
+/*  once the input is over the rest is written, and the runs are merged by the merger of external sort lazily, a block per    */
+/*  pull; if nothing was written, the output is the reservoir                                                                 */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+typedef int (*stream_merge_t)(context_t * ctx, const size_t * offs, size_t nruns, int inplace);
+
+struct pmr_stream
+{
+    context_t           ctx;        /* comparator and options, the deadline is of the stream, n is not used */
+    extsort_t           es;
+    pmr_options_t       opts;       /* options of sorts of batches */
+    stream_merge_t      merge_runs; /* merge of reservoir and batch */
+
+    int                 rc;         /* result of the 1st failure, the stream is unusable after it */
+    int                 sealed;     /* input is over */
+
+    /* input */
+
+    size_t              cap;        /* capacity of buffer */
+    void *              bufs[2];
+    int                 cur;        /* buffer being filled */
+    size_t              nbuf;       /* number of elements in buffer being filled */
+    pmr_async_t *       async;      /* sort of the other buffer, or NULL */
+    size_t              nasync;     /* number of elements in the other buffer */
+
+    /* run generation */
+
+    size_t              limit;      /* max. number of elements of reservoir and of the next run */
+    void *              res;        /* reservoir of the current run */
+    size_t              resoff;     /* start of reservoir in its buffer */
+    size_t              nres;
+    void *              dead;       /* sorted elements of the next run */
+    size_t              ndead;
+    void *              last;       /* the last element written to the current run */
+    int                 open;       /* the current run is written to */
+
+    int                 tmp;        /* temporary file of runs, or -1 */
+    int                 tmp2;       /* temporary file of merge passes, or -1 */
+    extsort_run_t *     runs;
+    size_t              nruns;
+    size_t              maxruns;
+    off_t               end;        /* end of runs in file in elements */
+
+    /* output */
+
+    int                 merging;    /* output is merged by merger, else it is reservoir */
+    extsort_merger_t    merger;
+    void *              out;        /* rest of output block */
+    size_t              nout;
+};
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+static inline int _stream_fail(pmr_stream_t * stream, int rc)
+{
+    if (stream->rc == 0)
+        stream->rc = rc;
+
+    return rc;
+}
+
+/*
+ * checks the token and the deadline of stream, the timeout of options of batch sort is set to the time left
+ */
+static int _stream_cancelled(pmr_stream_t * stream)
+{
+    int rc = _extsort_rc(_cancelled(&stream->ctx, NULL));
+    if (rc == 0 && stream->ctx.deadline != 0)
+    {
+        uint64_t now = _now();
+        uint64_t left = stream->ctx.deadline > now ? stream->ctx.deadline - now : 1;
+
+        stream->opts.timeout_ms = (unsigned int)IDIV_UP(left, 1000000ULL);
+    }
+
+    return rc;
+}
+
+/*
+ * number of leading elements of sorted [base, n) less than key
+ */
+static size_t _stream_lower(pmr_stream_t * stream, const void * base, size_t n, const void * key)
+{
+    context_t * ctx = &stream->ctx;
+    cmpr_t cmp = (cmpr_t)ctx->cmp;
+
+    size_t lo = 0;
+    while (n != 0)
+    {
+        size_t half = n >> 1;
+
+        const void * x = (const char *)base + (lo + half) * ctx->sz;
+
+        if ((ctx->desc ? cmp((void *)ctx->thunk, key, x) : cmp((void *)ctx->thunk, x, key)) < 0)
+        {
+            lo += half + 1;
+            n -= half + 1;
+        }
+        else
+            n = half;
+    }
+
+    return lo;
+}
+
+/*
+ * append n sorted elements to sorted [base, m) and merge them
+ */
+static int _stream_merge(pmr_stream_t * stream, void * base, size_t m, const void * elts, size_t n)
+{
+    context_t * ctx = &stream->ctx;
+
+    if (n == 0)
+        return 0;
+
+    PMR_MEMCPY(_extsort_at(base, m, ctx->sz), elts, n * ctx->sz);
+
+    if (m == 0)
+        return 0;
+
+    size_t offs[3] = { 0, m, m + n };
+    context_t mctx = _ctx_sub(ctx, base, m + n, NULL);
+
+    return _extsort_rc(stream->merge_runs(&mctx, offs, 2, 0));
+}
+
+/*
+ * write n elements to the current run (a new one if no run is open)
+ */
+static int _stream_write(pmr_stream_t * stream, const void * elts, size_t n)
+{
+    size_t sz = stream->ctx.sz;
+
+    if (n == 0)
+        return 0;
+
+    if (stream->tmp < 0 && (stream->tmp = _extsort_tmpfile(stream->es.tmpdir)) < 0)
+        return -1;
+
+    if (!stream->open)
+    {
+        if (stream->nruns == stream->maxruns)
+        {
+            size_t maxruns = stream->maxruns != 0 ? 2 * stream->maxruns : 16;
+
+            extsort_run_t * runs = PMR_REALLOC(stream->runs, sizeof(extsort_run_t) * maxruns);
+            if (runs == NULL)
+            {
+                errno = ENOMEM;
+                return -1;
+            }
+
+            stream->runs = runs;
+            stream->maxruns = maxruns;
+        }
+
+        stream->runs[stream->nruns].off = stream->end;
+        stream->runs[stream->nruns].n = 0;
+        stream->nruns++;
+        stream->open = 1;
+    }
+
+    extsort_op_t op = { stream->tmp, 1, (void *)elts, n * sz, stream->end * (off_t)sz };
+    if ((errno = _extsort_pio(&op)) != 0)
+        return -1;
+
+    stream->runs[stream->nruns - 1].n += n;
+    stream->end += (off_t)n;
+
+    PMR_MEMCPY(stream->last, _extsort_at((void *)elts, n - 1, sz), sz);
+
+    return 0;
+}
+
+/*
+ * run generation from sorted batch
+ */
+static int _stream_feed(pmr_stream_t * stream, const void * batch, size_t n)
+{
+    size_t sz = stream->ctx.sz;
+
+    /* the elements less than the last written one go to the next run */
+    size_t k = stream->open ? _stream_lower(stream, batch, n, stream->last) : 0;
+
+    int rc = _stream_merge(stream, stream->dead, stream->ndead, batch, k);
+    if (rc != 0)
+        return rc;
+
+    stream->ndead += k;
+
+    if (stream->resoff + stream->nres + (n - k) > stream->limit + stream->cap)
+    {
+        PMR_MEMMOVE(stream->res, _extsort_at(stream->res, stream->resoff, sz), stream->nres * sz);
+        stream->resoff = 0;
+    }
+
+    rc = _stream_merge(stream, _extsort_at(stream->res, stream->resoff, sz), stream->nres, _extsort_at((void *)batch, k, sz), n - k);
+    if (rc != 0)
+        return rc;
+
+    stream->nres += n - k;
+
+    /* the least elements of reservoir are written while over the limit, the run ends once reservoir is exhausted */
+    while (stream->nres + stream->ndead > stream->limit)
+    {
+        if (stream->nres == 0)
+        {
+            void * t = stream->res;
+            stream->res = stream->dead;
+            stream->dead = t;
+
+            stream->resoff = 0;
+            stream->nres = stream->ndead;
+            stream->ndead = 0;
+            stream->open = 0;
+            continue;
+        }
+
+        size_t e = stream->nres + stream->ndead - stream->limit;
+        if (e > stream->nres)
+            e = stream->nres;
+
+        if (_stream_write(stream, _extsort_at(stream->res, stream->resoff, sz), e) != 0)
+            return -1;
+
+        stream->resoff += e;
+        stream->nres -= e;
+    }
+
+    return 0;
+}
+
+/*
+ * finish of the sort of full buffer, then feed of it
+ */
+static int _stream_drain(pmr_stream_t * stream)
+{
+    if (stream->async == NULL)
+        return 0;
+
+    int rc = _extsort_rc(pmr_wait(stream->async));
+    stream->async = NULL;
+
+    if (rc == 0)
+        rc = _stream_feed(stream, stream->bufs[stream->cur ^ 1], stream->nasync);
+
+    return rc;
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+static pmr_stream_t * _stream_create(context_t * ctx, extsort_sort_t sort, extsort_merge_t merge, extsort_cut_t cut, stream_merge_t merge_runs,
+                                        const pmr_options_t * opts)
+{
+    size_t sz = ctx->sz;
+
+    size_t budget = opts != NULL && opts->mem_budget != 0 ? opts->mem_budget : _PMR_EXTSORT_BUDGET;
+
+    /* the budget is of 10 buffers: 2 buffers of input, reservoir and the next run of 3 buffers each (the limit and a batch),
+       and the scratch of the sort of batch along with the one of merge of the previous batch, a buffer each */
+    size_t cap = budget / 10 / sz;
+    if (cap == 0)
+        cap = 1;
+
+    size_t limit = 2 * cap;
+
+    pmr_stream_t * stream = PMR_MALLOC(sizeof(pmr_stream_t));
+    if (stream == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    memset(stream, 0, sizeof(*stream));
+    memcpy((void *)&stream->ctx, ctx, sizeof(*ctx)); /* context has constant fields */
+
+    stream->es.ctx = &stream->ctx;
+    stream->es.sort = sort;
+    stream->es.merge = merge;
+    stream->es.cut = cut;
+    stream->es.budget = budget;
+    stream->es.tmpdir = opts != NULL ? opts->tmpdir : NULL;
+
+    stream->opts.cmp_cost = ctx->cost;
+    stream->opts.cancel = ctx->cancel;
+    stream->opts.flags = ctx->desc ? PMR_DESCENDING : 0;
+    stream->merge_runs = merge_runs;
+
+    stream->cap = cap;
+    stream->limit = limit;
+    stream->tmp = -1;
+    stream->tmp2 = -1;
+
+    stream->bufs[0] = PMR_MALLOC(cap * sz);
+    stream->bufs[1] = PMR_MALLOC(cap * sz);
+    stream->res = PMR_MALLOC((limit + cap) * sz);
+    stream->dead = PMR_MALLOC((limit + cap) * sz);
+    stream->last = PMR_MALLOC(sz);
+
+    if (stream->bufs[0] == NULL || stream->bufs[1] == NULL || stream->res == NULL || stream->dead == NULL || stream->last == NULL)
+    {
+        PMR_FREE(stream->last);
+        PMR_FREE(stream->dead);
+        PMR_FREE(stream->res);
+        PMR_FREE(stream->bufs[1]);
+        PMR_FREE(stream->bufs[0]);
+        PMR_FREE(stream);
+
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return stream;
+}
+
+static int _stream_push(pmr_stream_t * stream, const void * elts, size_t n)
+{
+    size_t sz = stream->ctx.sz;
+
+    if (stream->rc != 0)
+        return stream->rc;
+
+    if (stream->sealed)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int rc = _stream_cancelled(stream);
+    if (rc != 0)
+        return _stream_fail(stream, rc);
+
+    while (n != 0)
+    {
+        size_t m = stream->cap - stream->nbuf;
+        if (m > n)
+            m = n;
+
+        PMR_MEMCPY(_extsort_at(stream->bufs[stream->cur], stream->nbuf, sz), elts, m * sz);
+
+        stream->nbuf += m;
+        elts = (const char *)elts + m * sz;
+        n -= m;
+
+        if (stream->nbuf < stream->cap)
+            break;
+
+        /* the full buffer is sorted in background while the previous one feeds run generation and then is refilled */
+        pmr_async_t * async = NULL;
+        if (stream->async != NULL)
+        {
+            async = stream->async;
+            stream->async = NULL;
+
+            rc = _extsort_rc(pmr_wait(async));
+            if (rc != 0)
+                return _stream_fail(stream, rc);
+        }
+
+        rc = _stream_cancelled(stream);
+        if (rc != 0)
+            return _stream_fail(stream, rc);
+
+        void * full = stream->bufs[stream->cur];
+        size_t nfull = stream->nbuf;
+
+        stream->async = pmergesort_async(full, nfull, sz, (void *)stream->ctx.thunk, (cmpr_t)stream->ctx.cmp, &stream->opts, NULL, NULL);
+        if (stream->async == NULL)
+            return _stream_fail(stream, -1);
+
+        if (async != NULL)
+        {
+            rc = _stream_feed(stream, stream->bufs[stream->cur ^ 1], stream->nasync);
+            if (rc != 0)
+                return _stream_fail(stream, rc);
+        }
+
+        stream->nasync = nfull;
+        stream->cur ^= 1;
+        stream->nbuf = 0;
+    }
+
+    return 0;
+}
+
+/*
+ * end of input: the rest is fed and written, then the merge of runs is opened
+ */
+static int _stream_seal(pmr_stream_t * stream)
+{
+    size_t sz = stream->ctx.sz;
+
+    stream->sealed = 1;
+
+    int rc = _stream_drain(stream);
+    if (rc == 0)
+        rc = _stream_cancelled(stream);
+
+    if (rc != 0)
+        return _stream_fail(stream, rc);
+
+    rc = _extsort_rc(pmergesort_ex(stream->bufs[stream->cur], stream->nbuf, sz, (void *)stream->ctx.thunk, (cmpr_t)stream->ctx.cmp, &stream->opts));
+    if (rc == 0)
+        rc = _stream_feed(stream, stream->bufs[stream->cur], stream->nbuf);
+
+    if (rc != 0)
+        return _stream_fail(stream, rc);
+
+    stream->nbuf = 0;
+
+    if (stream->nruns == 0)
+    {
+        /* nothing was written, so nothing went to the next run */
+        stream->out = _extsort_at(stream->res, stream->resoff, sz);
+        stream->nout = stream->nres;
+        return 0;
+    }
+
+    if (_stream_write(stream, _extsort_at(stream->res, stream->resoff, sz), stream->nres) != 0)
+        return _stream_fail(stream, -1);
+
+    stream->open = 0;
+
+    if (_stream_write(stream, stream->dead, stream->ndead) != 0)
+        return _stream_fail(stream, -1);
+
+    stream->nres = 0;
+    stream->ndead = 0;
+
+    /* the budget goes to the merge now */
+    PMR_FREE(stream->dead);
+    PMR_FREE(stream->res);
+    PMR_FREE(stream->bufs[1]);
+    PMR_FREE(stream->bufs[0]);
+
+    stream->dead = NULL;
+    stream->res = NULL;
+    stream->bufs[1] = NULL;
+    stream->bufs[0] = NULL;
+
+    rc = _extsort_passes(&stream->es, &stream->tmp, &stream->tmp2, stream->runs, &stream->nruns);
+    if (rc == 0)
+        rc = _extsort_merger_open(&stream->merger, &stream->es, stream->tmp, stream->runs, stream->nruns);
+
+    if (rc != 0)
+        return _stream_fail(stream, rc);
+
+    stream->merging = 1;
+
+    return 0;
+}
+
+static int _stream_pull(pmr_stream_t * stream, void * dst, size_t max, size_t * n)
+{
+    size_t sz = stream->ctx.sz;
+
+    *n = 0;
+
+    if (stream->rc != 0)
+        return stream->rc;
+
+    if (!stream->sealed)
+    {
+        int rc = _stream_seal(stream);
+        if (rc != 0)
+            return rc;
+    }
+    else
+    {
+        int rc = _stream_cancelled(stream);
+        if (rc != 0)
+            return _stream_fail(stream, rc);
+    }
+
+    while (*n < max)
+    {
+        if (stream->nout == 0)
+        {
+            if (!stream->merging || stream->merger.left == 0)
+                break;
+
+            int rc = _extsort_merger_step(&stream->merger, NULL);
+            if (rc != 0)
+                return _stream_fail(stream, rc);
+
+            stream->out = stream->merger.out;
+            stream->nout = stream->merger.nout;
+        }
+
+        size_t m = max - *n < stream->nout ? max - *n : stream->nout;
+
+        PMR_MEMCPY(_extsort_at(dst, *n, sz), stream->out, m * sz);
+
+        stream->out = _extsort_at(stream->out, m, sz);
+        stream->nout -= m;
+        *n += m;
+    }
+
+    return 0;
+}
+
+static void _stream_destroy(pmr_stream_t * stream)
+{
+    if (stream->async != NULL)
+        (void)pmr_wait(stream->async);
+
+    if (stream->merging)
+        _extsort_merger_close(&stream->merger);
+
+    if (stream->tmp2 >= 0)
+        (void)close(stream->tmp2);
+
+    if (stream->tmp >= 0)
+        (void)close(stream->tmp);
+
+    PMR_FREE(stream->runs);
+    PMR_FREE(stream->last);
+    PMR_FREE(stream->dead);
+    PMR_FREE(stream->res);
+    PMR_FREE(stream->bufs[1]);
+    PMR_FREE(stream->bufs[0]);
+    PMR_FREE(stream);
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
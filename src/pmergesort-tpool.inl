@@ -14,6 +14,13 @@
 #include <pthread.h>
 #include <signal.h>
 #include <errno.h>
+#include <sched.h>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 #ifdef __MACH__
 #include <mach/clock.h>
@@ -74,6 +81,7 @@ struct thr_pool
     active_t *      pool_active;            /* list of threads performing work */
     job_t *         pool_head;              /* head of FIFO job queue */
     job_t *         pool_tail;              /* tail of FIFO job queue */
+    job_t *         pool_free;              /* free list of recycled jobs */
     pthread_attr_t  pool_attr;              /* attributes of the workers */
     int             pool_flags;             /* see below */
     unsigned int    pool_linger;            /* seconds before idle workers exit */
@@ -81,6 +89,15 @@ struct thr_pool
     int             pool_maximum;           /* maximum number of worker threads */
     int             pool_nthreads;          /* current number of worker threads */
     int             pool_idle;              /* number of idle workers */
+    int             pool_policy;            /* scheduling policy of workers, or PMR_SCHED_INHERIT */
+    int             pool_priority;          /* scheduling priority of workers */
+    int             pool_nice;              /* nice value of workers */
+    int *           pool_cpus;              /* CPUs to pin workers to (round-robin) */
+    int             pool_ncpus;             /* number of CPUs to pin workers to */
+    unsigned int    pool_seq;               /* sequence number of the next worker */
+    unsigned int    pool_gen;               /* generation of workers configuration */
+    int             pool_users;             /* asynchronous sorts running on the pool */
+    thr_pool_t *    pool_retired;           /* next replaced pool of asynchronous sorts */
 };
 
 /* pool_flags */
@@ -170,6 +187,35 @@ static void job_cleanup(thr_pool_t * pool)
         notify_waiters(pool);
 }
 
+/*
+ * Apply scheduling and placement settings of the pool to the worker.
+ * Failures are not fatal, the worker keeps inherited settings.
+ */
+static void worker_setup(thr_pool_t * pool, unsigned int seq)
+{
+    if (pool->pool_policy != PMR_SCHED_INHERIT)
+    {
+        struct sched_param sp = { pool->pool_priority };
+        (void)pthread_setschedparam(pthread_self(), pool->pool_policy, &sp);
+    }
+
+#ifdef __linux__
+    if (pool->pool_nice != 0)
+        (void)setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), pool->pool_nice);
+
+    if (pool->pool_ncpus > 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(pool->pool_cpus[seq % pool->pool_ncpus], &set);
+
+        (void)pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#else
+    (void)seq; /* no portable per-thread nice value and affinity */
+#endif
+}
+
 static void * worker_thread(void * arg)
 {
     int timedout;
@@ -184,14 +230,18 @@ static void * worker_thread(void * arg)
      * This is the worker's main loop.  It will only be left
      * if a timeout occurs or if the pool is being destroyed.
      */
+    (void)pthread_mutex_lock(&pool->pool_mutex);
+    unsigned int seq = pool->pool_seq++;
+    (void)pthread_mutex_unlock(&pool->pool_mutex);
+
+    /* settings are fixed once jobs are queued, no need to hold the lock over syscalls */
+    worker_setup(pool, seq);
+
     (void)pthread_mutex_lock(&pool->pool_mutex);
     pthread_cleanup_push((void (*)(void *))worker_cleanup, pool);
 
     active.active_tid = pthread_self();
 
-    struct sched_param sp = { sched_get_priority_max(SCHED_RR) };
-    (void)pthread_setschedparam(active.active_tid, SCHED_RR, &sp);
-
     for (;;)
     {
         /*
@@ -247,9 +297,11 @@ static void * worker_thread(void * arg)
                 pool->pool_tail = NULL;
             active.active_next = pool->pool_active;
             pool->pool_active = &active;
+            /* recycle job descriptor while still holding the lock */
+            job->job_next = pool->pool_free;
+            pool->pool_free = job;
             (void) pthread_mutex_unlock(&pool->pool_mutex);
             pthread_cleanup_push((void (*)(void *))job_cleanup, pool);
-            PMR_FREE(job);
             /*
              * Call the specified job function.
              */
@@ -349,12 +401,22 @@ static thr_pool_t * thr_pool_create(int min_threads, int max_threads, unsigned i
     pool->pool_active = NULL;
     pool->pool_head = NULL;
     pool->pool_tail = NULL;
+    pool->pool_free = NULL;
     pool->pool_flags = 0;
     pool->pool_linger = linger;
     pool->pool_minimum = min_threads;
     pool->pool_maximum = max_threads;
     pool->pool_nthreads = 0;
     pool->pool_idle = 0;
+    pool->pool_policy = PMR_SCHED_INHERIT;
+    pool->pool_priority = 0;
+    pool->pool_nice = 0;
+    pool->pool_cpus = NULL;
+    pool->pool_ncpus = 0;
+    pool->pool_seq = 0;
+    pool->pool_gen = 0;
+    pool->pool_users = 0;
+    pool->pool_retired = NULL;
 
     /*
      * We cannot just copy the attribute pointer.
@@ -385,6 +447,37 @@ static thr_pool_t * thr_pool_create(int min_threads, int max_threads, unsigned i
     return pool;
 }
 
+/*
+ * Set scheduling and placement of worker threads, must be called
+ * before the first job is queued.
+ *  policy:         scheduling policy, or PMR_SCHED_INHERIT.
+ *  priority:       scheduling priority within the policy.
+ *  nice:           nice value of workers (where supported).
+ *  cpus:           CPUs to pin workers to round-robin (can be NULL);
+ *                  the list is copied.
+ * On error, thr_pool_bind() returns -1 with errno set to the error code.
+ */
+static int thr_pool_bind(thr_pool_t * pool, int policy, int priority, int nice, const int * cpus, int ncpus)
+{
+    if (ncpus > 0)
+    {
+        if ((pool->pool_cpus = PMR_MALLOC(sizeof(int) * ncpus)) == NULL)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        memcpy(pool->pool_cpus, cpus, sizeof(int) * ncpus);
+        pool->pool_ncpus = ncpus;
+    }
+
+    pool->pool_policy = policy;
+    pool->pool_priority = priority;
+    pool->pool_nice = nice;
+
+    return 0;
+}
+
 /*
  * Enqueue a work request to the thread pool job queue.
  * If there are idle worker threads, awaken one to perform the job.
@@ -397,14 +490,31 @@ static thr_pool_t * thr_pool_create(int min_threads, int max_threads, unsigned i
  * The job is performed as if a new detached thread were created for it:
  *      pthread_create(NULL, attr, void *(*func)(void *), void *arg);
  *
+ * Job descriptors are recycled through the pool's free list,
+ * so the allocator is hit only while the pool warms up.
+ *
  * On error, thr_pool_queue() returns -1 with errno set to the error code.
  */
 static int thr_pool_queue(thr_pool_t * pool, void * (*func)(void *), void * arg)
 {
     job_t * job;
 
-    if ((job = PMR_MALLOC(sizeof (*job))) == NULL)
+    (void)pthread_mutex_lock(&pool->pool_mutex);
+
+    if ((job = pool->pool_free) != NULL)
     {
+        pool->pool_free = job->job_next;
+
+        _PMR_STAT_INC(jobs_reused);
+    }
+    else if ((job = PMR_MALLOC(sizeof (*job))) != NULL)
+    {
+        _PMR_STAT_INC(jobs_allocated);
+    }
+    else
+    {
+        (void)pthread_mutex_unlock(&pool->pool_mutex);
+
         errno = ENOMEM;
         return -1;
     }
@@ -413,8 +523,6 @@ static int thr_pool_queue(thr_pool_t * pool, void * (*func)(void *), void * arg)
     job->job_func = func;
     job->job_arg = arg;
 
-    (void)pthread_mutex_lock(&pool->pool_mutex);
-
     if (pool->pool_head == NULL)
         pool->pool_head = job;
     else
@@ -502,8 +610,17 @@ static void thr_pool_destroy(thr_pool_t * pool)
         PMR_FREE(job);
     }
 
+    for (job = pool->pool_free; job != NULL; job = pool->pool_free)
+    {
+        pool->pool_free = job->job_next;
+        PMR_FREE(job);
+    }
+
     (void)pthread_attr_destroy(&pool->pool_attr);
 
+    if (pool->pool_cpus != NULL)
+        PMR_FREE(pool->pool_cpus);
+
     PMR_FREE(pool);
 }
 
@@ -7,11 +7,19 @@
 
 /* -------------------------------------------------------------------------------------------------------------------------- */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE                 /* CPU affinity of threads */
+#endif
+
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "pmergesort.h"
+#include "pmergesort-pvt.h"
 
 /* -------------------------------------------------------------------------------------------------------------------------- */
 /* configure build                                                                                                            */
@@ -29,6 +37,10 @@
 #define PMR_PARALLEL_USE_OMP        0   /* enable build of parallel merge sort algorithms, use OpenMP */
 #endif
 
+#ifndef PMR_NUMA
+#define PMR_NUMA                    0   /* enable NUMA placement of chunks and temporary storage (Linux, pthreads) */
+#endif
+
 #ifndef PMR_RAW_ACCESS
 #define PMR_RAW_ACCESS              1   /* enable raw memory access, 0 implies the using of memmove & memcpy */
 #endif
@@ -67,14 +79,18 @@
 
 #ifdef __APPLE__
 #include <AvailabilityMacros.h>
-#elif PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS || PMR_PARALLEL_USE_OMP
-/* sentinel (temporary): reset to pthreads any attempt to compile parallel */
+#elif PMR_PARALLEL_USE_GCD
+/* sentinel: no GCD out of Mac OS X, reset to pthreads unless OpenMP is requested */
 #   undef  PMR_PARALLEL_USE_GCD
 #   define PMR_PARALLEL_USE_GCD         0
+#   if !PMR_PARALLEL_USE_OMP
 #   undef  PMR_PARALLEL_USE_PTHREADS
 #   define PMR_PARALLEL_USE_PTHREADS    1
-#   undef  PMR_PARALLEL_USE_OMP
-#   define PMR_PARALLEL_USE_OMP         0
+#   endif
+#endif
+
+#if PMR_PARALLEL_USE_OMP && (!defined(_OPENMP) || _OPENMP < 201307)
+#   error compile with OpenMP 4.0 or later enabled (e.g. -fopenmp) to use PMR_PARALLEL_USE_OMP
 #endif
 
 /* -------------------------------------------------------------------------------------------------------------------------- */
@@ -89,13 +105,19 @@
 #elif !PMR_PARALLEL_USE_GCD && PMR_PARALLEL_USE_PTHREADS && !PMR_PARALLEL_USE_OMP
 /*  parallel, pthreads  */
 #elif !PMR_PARALLEL_USE_GCD && !PMR_PARALLEL_USE_PTHREADS && PMR_PARALLEL_USE_OMP
-/*  parallel, OpenMP (if applicable)  */
+/*  parallel, OpenMP tasks (4.0 or later)  */
 #elif !PMR_PARALLEL_USE_GCD && !PMR_PARALLEL_USE_PTHREADS && !PMR_PARALLEL_USE_OMP
 /*  single-threaded  */
 #else
 #   error PMR_PARALLEL_USE_* misconfiguration
 #endif
 
+#if PMR_NUMA && !(PMR_PARALLEL_USE_PTHREADS && defined(__linux__))
+/*  NUMA placement requires control of the worker threads  */
+#   undef  PMR_NUMA
+#   define PMR_NUMA                     0
+#endif
+
 /* -------------------------------------------------------------------------------------------------------------------------- */
 /* fine tunings                                                                                                               */
 /* -------------------------------------------------------------------------------------------------------------------------- */
@@ -113,6 +135,22 @@
 #define _PMR_GCD_OVERCOMMIT         0   /* allow overcommit GCD queue beyond of the number CPU cores */
 #endif
 
+#ifndef _PMR_NCPU_REFRESH
+#define _PMR_NCPU_REFRESH           10  /* seconds to re-evaluate number of CPU available (0 - evaluate once) */
+#endif
+
+#ifndef _PMR_NCPU_LOAD
+#define _PMR_NCPU_LOAD              0   /* take system load into account when evaluate number of CPU available */
+#endif
+
+#ifndef _PMR_PARALLEL_GRAIN
+#define _PMR_PARALLEL_GRAIN         4096    /* min. number of elements per thread worth to wake it */
+#endif
+
+#ifndef _PMR_CMP_PROBE
+#define _PMR_CMP_PROBE              1   /* time a sample of comparator calls to tune parallel thresholds */
+#endif
+
 #ifndef _PMR_PARALLEL_MAY_SPAWN
 #define _PMR_PARALLEL_MAY_SPAWN     (PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS || PMR_PARALLEL_USE_OMP)
                                                     /* allow [sym]merge to spawn nested threads */
@@ -122,8 +160,9 @@
 /* some more useless fine tunings */
 /* -------------------------------------------------------------------------------------------------------------------------- */
 
-#define _PMR_PRESORT                binsort_run     /* method of pre-sort for initial subsegments,
-                                                        allowed: binsort, binsort_run, and binsort_mergerun */
+#define _PMR_PRESORT                binsort_adaptive    /* method of pre-sort for initial subsegments, allowed: binsort,
+                                                            binsort_run, binsort_mergerun, and binsort_adaptive (picks
+                                                            one of the last two by the leading run of subsegment) */
 
 #define _PMR_USE_4_MEM              PMR_RAW_ACCESS /* use dedicated int32 type memory ops */
 #define _PMR_USE_8_MEM              PMR_RAW_ACCESS /* use dedicated int64 type memory ops */
@@ -141,11 +180,42 @@
 #define _PMR_BLOCKLEN_SYMMERGE      32  /* 20 was as in built-in GO language function */
 #define _PMR_BLOCKLEN_MERGE         32
 
+#define _PMR_CMP_PROBES             32  /* number of comparator calls to time */
+#define _PMR_CMP_COST_REF           4   /* cost of comparator call (ns) the fixed thresholds are tuned for */
+
+#define _PMR_SLAB_NELTS             64  /* number of spawn descriptors per slab block */
+
+#define _PMR_SEGMENTED_CHUNKS       4   /* chunks per thread of segmented sort */
+
+#define _PMR_SELECT_SMALL           64  /* segment length to sort instead of partition on selection */
+#define _PMR_SELECT_SAMPLES         1024    /* max. size of sample to pick selection pivot from */
+
 /* -------------------------------------------------------------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------------------------------------------------------- */
 
 typedef struct thr_pool thr_pool_t;
 
+#if _PMR_CORE_PROFILE
+/*
+ * allocation counters of job and spawn descriptors for profiling purposes
+ */
+static pmergesort_stats_t _stats;
+
+#define _PMR_STAT_INC(name)         ((void)__sync_fetch_and_add(&_stats.name, 1))
+
+void pmergesort_stats(pmergesort_stats_t * stats)
+{
+    *stats = _stats;
+}
+
+void pmergesort_stats_reset(void)
+{
+    memset(&_stats, 0, sizeof(_stats));
+}
+#else
+#define _PMR_STAT_INC(name)         ((void)0)
+#endif
+
 #if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS || PMR_PARALLEL_USE_OMP
 
 #ifdef __APPLE__
@@ -160,7 +230,15 @@ typedef struct thr_pool thr_pool_t;
 #include <unistd.h>
 #endif
 
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+
 static int32_t _ncpu = -1;
+#if _PMR_NCPU_REFRESH && !PMR_PARALLEL_USE_OMP
+static int _ncpu_fixed = 0;     /* number of CPU is overridden */
+#endif
 
 #if _PMR_CORE_PROFILE
 /*
@@ -170,6 +248,9 @@ static int32_t _ncpu = -1;
 void pmergesort_nCPU(int32_t ncpu)
 {
     _ncpu = ncpu;
+#if _PMR_NCPU_REFRESH && !PMR_PARALLEL_USE_OMP
+    _ncpu_fixed = ncpu > 0;
+#endif
 }
 #endif
 
@@ -210,39 +291,250 @@ static __attribute__((noinline)) size_t cutOff(size_t n)
 #endif
 }
 
+/*
+ * scale number of threads for the sort of n elements,
+ * so small sorts do not pay for waking every worker
+ */
+static inline int scaleCPU(size_t n, int ncpu, size_t grain)
+{
+    size_t nmax = n / grain;
+
+    return nmax < (size_t)ncpu ? (int)nmax : ncpu;
+}
+
+#ifdef __linux__
+/*
+ * CPU bandwidth limit of cgroup in CPUs, or 0 if there is no limit
+ */
+static int32_t __cgroup_quota(const char * path, const char * quota_name, const char * period_name)
+{
+    char fname[4096 + 64];
+
+    long long quota = -1;
+    long long period = 0;
+
+    if (period_name == NULL)
+    {
+        /* cgroup v2: "$MAX $PERIOD" or "max $PERIOD" */
+        snprintf(fname, sizeof(fname), "%s/%s", path, quota_name);
+
+        FILE * f = fopen(fname, "r");
+        if (f == NULL)
+            return 0;
+
+        if (fscanf(f, "%lld %lld", &quota, &period) != 2)
+            quota = -1;
+
+        fclose(f);
+    }
+    else
+    {
+        /* cgroup v1: separate files, quota is -1 if unlimited */
+        snprintf(fname, sizeof(fname), "%s/%s", path, quota_name);
+
+        FILE * f = fopen(fname, "r");
+        if (f == NULL)
+            return 0;
+
+        if (fscanf(f, "%lld", &quota) != 1)
+            quota = -1;
+
+        fclose(f);
+
+        snprintf(fname, sizeof(fname), "%s/%s", path, period_name);
+
+        if ((f = fopen(fname, "r")) == NULL)
+            return 0;
+
+        if (fscanf(f, "%lld", &period) != 1)
+            period = 0;
+
+        fclose(f);
+    }
+
+    if (quota <= 0 || period <= 0)
+        return 0;
+
+    return (int32_t)((quota + period - 1) / period);
+}
+
+/*
+ * check if comma separated list of controllers contains controller
+ */
+static int __cgroup_has(const char * controllers, const char * controller)
+{
+    size_t len = strlen(controller);
+
+    for (const char * p = controllers; p != NULL; p = strchr(p, ','), p = p != NULL ? p + 1 : NULL)
+    {
+        if (strncmp(p, controller, len) == 0 && (p[len] == ',' || p[len] == '\0'))
+            return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * the tightest CPU bandwidth limit of the process cgroups (v2 or v1) up to the hierarchy root, or 0 if there is no limit
+ */
+static int32_t __numCPU_quota()
+{
+    int32_t ncpu = 0;
+
+    FILE * f = fopen("/proc/self/cgroup", "r");
+    if (f == NULL)
+        return 0;
+
+    char line[4096];
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        /* "hierarchy-ID:controller-list:cgroup-path" */
+        char * controllers = strchr(line, ':');
+        char * cgpath = controllers != NULL ? strchr(controllers + 1, ':') : NULL;
+        if (cgpath == NULL)
+            continue;
+
+        *cgpath++ = '\0';
+        controllers++;
+        cgpath[strcspn(cgpath, "\n")] = '\0';
+
+        const char * root;
+        const char * quota_name;
+        const char * period_name;
+
+        if (*controllers == '\0')
+        {
+            root = "/sys/fs/cgroup";
+            quota_name = "cpu.max";
+            period_name = NULL;
+        }
+        else if (__cgroup_has(controllers, "cpu"))
+        {
+            root = "/sys/fs/cgroup/cpu";
+            quota_name = "cpu.cfs_quota_us";
+            period_name = "cpu.cfs_period_us";
+        }
+        else
+            continue;
+
+        /* walk up the hierarchy, within cgroup namespace the path is relative to the mount root */
+        char path[4096];
+        snprintf(path, sizeof(path), "%s%s", root, cgpath);
+
+        for (;;)
+        {
+            int32_t quota = __cgroup_quota(path, quota_name, period_name);
+            if (quota > 0 && (ncpu == 0 || quota < ncpu))
+                ncpu = quota;
+
+            char * sep = strrchr(path, '/');
+            if (sep == NULL || (size_t)(sep - path) < strlen(root))
+                break;
+
+            *sep = '\0';
+        }
+    }
+
+    fclose(f);
+
+    return ncpu;
+}
+#endif
+
 #if !PMR_PARALLEL_USE_OMP
-static void __numCPU_initialize(_PMR_ONCE_ARG)
+static int32_t __numCPU_probe()
 {
+    int32_t ncpu32 = 1;
+
 #ifdef __APPLE__
     int32_t mib[] = { CTL_HW, HW_AVAILCPU };
 
-    size_t sz = sizeof(_ncpu);
-    if (sysctl(mib, sizeof(mib) / sizeof(mib[0]), &_ncpu, &sz, NULL, 0) != 0)
-        _ncpu = 1;
-    else if (_ncpu <= 0)
-        _ncpu = 1;
+    size_t sz = sizeof(ncpu32);
+    if (sysctl(mib, sizeof(mib) / sizeof(mib[0]), &ncpu32, &sz, NULL, 0) != 0)
+        ncpu32 = 1;
+    else if (ncpu32 <= 0)
+        ncpu32 = 1;
 #elif __hpux
     int ncpu = mpctl(MPC_GETNUMSPUS, NULL, NULL);
     if (ncpu <= 0)
-        _ncpu = 1;
+        ncpu32 = 1;
     else
-        _ncpu = (int32_t)ncpu;
+        ncpu32 = (int32_t)ncpu;
 #elif __sgi
     long ncpu = sysconf(_SC_NPROC_ONLN);
     if (ncpu <= 0)
-        _ncpu = 1;
+        ncpu32 = 1;
+    else
+        ncpu32 = (int32_t)ncpu;
+#elif __linux__
+    /* CPUs the process is allowed to run on */
+    cpu_set_t set;
+    long ncpu = sched_getaffinity(0, sizeof(set), &set) == 0 ? CPU_COUNT(&set) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu <= 0)
+        ncpu32 = 1;
     else
-        _ncpu = (int32_t)ncpu;
+        ncpu32 = (int32_t)ncpu;
+
+    /* bandwidth limit of container */
+    int32_t quota = __numCPU_quota();
+    if (quota > 0 && quota < ncpu32)
+        ncpu32 = quota;
 #else
     long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
     if (ncpu <= 0)
-        _ncpu = 1;
+        ncpu32 = 1;
     else
-        _ncpu = (int32_t)ncpu;
+        ncpu32 = (int32_t)ncpu;
 #endif
+
+#if _PMR_NCPU_LOAD
+    /* leave CPUs busy with other work alone */
+    double load;
+    if (getloadavg(&load, 1) == 1 && load >= 1.0)
+    {
+        int32_t idle = ncpu32 - (int32_t)load;
+        ncpu32 = idle > 1 ? idle : 1;
+    }
+#endif
+
+    return ncpu32;
+}
+
+static void __numCPU_initialize(_PMR_ONCE_ARG)
+{
+    _ncpu = __numCPU_probe();
 }
 #endif /* PMR_PARALLEL_USE_OMP */
 
+#if _PMR_NCPU_REFRESH && !PMR_PARALLEL_USE_OMP
+static time_t _ncpu_stamp = 0;  /* time of last evaluation */
+
+/*
+ * re-evaluate number of CPU periodically, since limits of container or load may change
+ */
+static inline void __numCPU_refresh()
+{
+    if (_ncpu_fixed)
+        return;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    time_t stamp = _ncpu_stamp;
+    if (ts.tv_sec - stamp < _PMR_NCPU_REFRESH)
+        return;
+
+    /* only one thread re-evaluates */
+    if (!__sync_bool_compare_and_swap(&_ncpu_stamp, stamp, ts.tv_sec))
+        return;
+
+    if (stamp != 0)
+        _ncpu = __numCPU_probe();
+}
+#else
+#define __numCPU_refresh()
+#endif
+
 /* -------------------------------------------------------------------------------------------------------------------------- */
 #if PMR_PARALLEL_USE_PTHREADS
 /* -------------------------------------------------------------------------------------------------------------------------- */
@@ -255,12 +547,219 @@ static pthread_once_t _once = PTHREAD_ONCE_INIT;
 
     if (_ncpu <= 0)
         pthread_once(&_once, __numCPU_initialize);
+    else
+        __numCPU_refresh();
 
     return (int)_ncpu;
 }
 
 /* -------------------------------------------------------------------------------------------------------------------------- */
 
+/*
+ * scheduling and placement of pool workers
+ */
+static pthread_mutex_t _workers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pmergesort_workers_t _workers = { PMR_SCHED_INHERIT, 0, 0, PMR_AFFINITY_NONE, NULL, 0 };
+static unsigned int _workers_gen = 0;
+
+#ifdef __linux__
+/*
+ * primary hardware thread of the core CPU belongs to, or -1 if unknown
+ */
+static int __core_primary(int cpu)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+
+    FILE * f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+
+    int primary;
+    if (fscanf(f, "%d", &primary) != 1)
+        primary = -1;
+
+    fclose(f);
+
+    return primary;
+}
+#endif
+
+/*
+ * resolve the list of CPUs to pin workers to, returns number of CPUs in list, or -1 with errno set
+ */
+static int __workers_cpus(const pmergesort_workers_t * workers, int ** cpus)
+{
+    *cpus = NULL;
+
+    if (workers->affinity == PMR_AFFINITY_CPUSET)
+    {
+#ifdef __linux__
+        cpu_set_t allowed;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+            return -1;
+#endif
+
+        if ((*cpus = PMR_MALLOC(sizeof(int) * workers->ncpus)) == NULL)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        /* keep listed order, drop CPUs out of range or not allowed to the process */
+        int n = 0;
+        for (size_t i = 0; i < workers->ncpus; i++)
+        {
+            int cpu = workers->cpus[i];
+            if (cpu < 0)
+                continue;
+#ifdef __linux__
+            if (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed))
+                continue;
+#endif
+            (*cpus)[n++] = cpu;
+        }
+
+        if (n == 0)
+        {
+            PMR_FREE(*cpus);
+            *cpus = NULL;
+            errno = EINVAL; /* nothing to pin to */
+            return -1;
+        }
+
+        return n;
+    }
+#ifdef __linux__
+    else if (workers->affinity == PMR_AFFINITY_CORES)
+    {
+        cpu_set_t allowed;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+            return -1;
+
+        /* candidates are allowed CPUs of the list (if any) */
+        if (workers->ncpus != 0)
+        {
+            cpu_set_t listed;
+            CPU_ZERO(&listed);
+            for (size_t i = 0; i < workers->ncpus; i++)
+            {
+                if (workers->cpus[i] >= 0 && workers->cpus[i] < CPU_SETSIZE)
+                    CPU_SET(workers->cpus[i], &listed);
+            }
+
+            CPU_AND(&allowed, &allowed, &listed);
+        }
+
+        if (CPU_COUNT(&allowed) == 0)
+        {
+            errno = EINVAL; /* nothing to pin to */
+            return -1;
+        }
+
+        if ((*cpus = PMR_MALLOC(sizeof(int) * CPU_SETSIZE)) == NULL)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        int n = 0;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (!CPU_ISSET(cpu, &allowed))
+                continue;
+
+            /* skip SMT siblings of candidate primary, a sibling stands for its core if the primary is not a candidate */
+            int primary = __core_primary(cpu);
+            if (primary < 0 || primary == cpu || primary >= CPU_SETSIZE || !CPU_ISSET(primary, &allowed))
+                (*cpus)[n++] = cpu;
+        }
+
+        return n;
+    }
+#endif
+
+    return 0;
+}
+
+/*
+ * generation of workers configuration, pools of older one are re-created
+ */
+static inline unsigned int __workers_gen()
+{
+    return __sync_fetch_and_add(&_workers_gen, 0);
+}
+
+int pmergesort_workers(const pmergesort_workers_t * workers)
+{
+    if (workers == NULL)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (workers->policy != PMR_SCHED_INHERIT
+            && (workers->priority < sched_get_priority_min(workers->policy)
+                || workers->priority > sched_get_priority_max(workers->policy)))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (workers->affinity < PMR_AFFINITY_NONE || workers->affinity > PMR_AFFINITY_CORES
+            || (workers->affinity == PMR_AFFINITY_CPUSET && (workers->cpus == NULL || workers->ncpus == 0)))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int * cpus;
+    int ncpus = __workers_cpus(workers, &cpus);
+    if (ncpus < 0)
+        return -1;
+
+    (void)pthread_mutex_lock(&_workers_lock);
+
+    PMR_FREE((void *)_workers.cpus);
+
+    _workers = *workers;
+    _workers.cpus = cpus;
+    _workers.ncpus = (size_t)ncpus;
+    (void)__sync_add_and_fetch(&_workers_gen, 1); /* pools are re-created lazily */
+
+    (void)pthread_mutex_unlock(&_workers_lock);
+
+    return 0;
+}
+
+static thr_pool_t * __thPool_create()
+{
+    (void)pthread_mutex_lock(&_workers_lock);
+
+    /*
+     *  we have to create pool with some limits on simultaneously running
+     *  threads. presuambly, for better performance, there shouldn't be
+     *  more threads than number of CPU cores.
+     */
+    thr_pool_t * pool = thr_pool_create(numCPU() / 2, numCPU(), 1, NULL);
+    if (pool != NULL)
+    {
+        if (thr_pool_bind(pool, _workers.policy, _workers.priority, _workers.nice, _workers.cpus, (int)_workers.ncpus) != 0)
+        {
+            thr_pool_destroy(pool);
+            pool = NULL;
+        }
+        else
+            pool->pool_gen = _workers_gen;
+    }
+
+    (void)pthread_mutex_unlock(&_workers_lock);
+
+    return pool;
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
 static pthread_key_t _sKey = 0;
 
 static __attribute__((noinline)) void __thPool_finalize(void * value)
@@ -281,14 +780,16 @@ static pthread_once_t _once = PTHREAD_ONCE_INIT;
         pthread_once(&_once, __thPoolKey_initialize);
 
     thr_pool_t * pool = (thr_pool_t *)pthread_getspecific(_sKey);
+    if (pool != NULL && pool->pool_gen != __workers_gen())
+    {
+        /* workers configuration changed since the pool was created */
+        thr_pool_destroy(pool);
+        pool = NULL;
+    }
+
     if (pool == NULL)
     {
-        /*
-         *  we have to create pool with some limits on simultaneously running
-         *  threads. presuambly, for better performance, there shouldn't be
-         *  more threads than number of CPU cores.
-         */
-        pool = thr_pool_create(numCPU() / 2, numCPU(), 1, NULL);
+        pool = __thPool_create();
 
         pthread_setspecific(_sKey, pool);
     }
@@ -297,34 +798,99 @@ static pthread_once_t _once = PTHREAD_ONCE_INIT;
 }
 
 /* -------------------------------------------------------------------------------------------------------------------------- */
-#elif PMR_PARALLEL_USE_GCD
-/* -------------------------------------------------------------------------------------------------------------------------- */
-
-#ifdef __INTEL_COMPILER
-// Intel compiler __builtin_assume "hack"
-#define __builtin_assume(c) __assume(c)
-#endif
 
-#include <dispatch/dispatch.h>
-/* -------------------------------------------------------------------------------------------------------------------------- */
+/*
+ * pool shared by asynchronous sorts, re-created when workers configuration changes; the replaced pool is kept until its
+ * last sort completes and is destroyed by the next request then
+ */
+static pthread_mutex_t _async_lock = PTHREAD_MUTEX_INITIALIZER;
+static thr_pool_t * _async_pool = NULL;
+static thr_pool_t * _async_retired = NULL; /* list of replaced pools */
 
-struct thr_pool
+static thr_pool_t * asyncPool()
 {
-    dispatch_queue_t        queue;
-#if _PMR_PARALLEL_MAY_SPAWN
-    dispatch_group_t        group;
-#if !_PMR_GCD_OVERCOMMIT
-    dispatch_semaphore_t    mutex; /* semaphore to prevent the threads overcommit flood */
-#endif
-#endif
-};
+    (void)pthread_mutex_lock(&_async_lock);
 
-#ifdef __PGI
-// PGI compiler __attribute__((__transparent_union__)) "hack"
-#define DISPATCH_OBJECT_T(o) ((dispatch_object_t){ (void *)(o) })
-#else
-#define DISPATCH_OBJECT_T(o) (o)
-#endif
+    for (thr_pool_t ** link = &_async_retired; *link != NULL;)
+    {
+        thr_pool_t * pool = *link;
+        if (pool->pool_users == 0)
+        {
+            *link = pool->pool_retired;
+            thr_pool_destroy(pool);
+        }
+        else
+            link = &pool->pool_retired;
+    }
+
+    if (_async_pool != NULL && _async_pool->pool_gen != __workers_gen())
+    {
+        /* workers configuration changed since the pool was created */
+        _async_pool->pool_retired = _async_retired;
+        _async_retired = _async_pool;
+        _async_pool = NULL;
+    }
+
+    if (_async_pool == NULL)
+        _async_pool = __thPool_create();
+
+    thr_pool_t * pool = _async_pool;
+    if (pool != NULL)
+        pool->pool_users++;
+
+    (void)pthread_mutex_unlock(&_async_lock);
+
+    return pool;
+}
+
+/*
+ * the sort is completed, the pool may be destroyed when replaced
+ */
+static void asyncPool_release(thr_pool_t * pool)
+{
+    (void)pthread_mutex_lock(&_async_lock);
+    pool->pool_users--;
+    (void)pthread_mutex_unlock(&_async_lock);
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+#elif PMR_PARALLEL_USE_GCD
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+int pmergesort_workers(__unused const pmergesort_workers_t * workers)
+{
+    errno = ENOTSUP; /* GCD manages threads on its own */
+    return -1;
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+#ifdef __INTEL_COMPILER
+// Intel compiler __builtin_assume "hack"
+#define __builtin_assume(c) __assume(c)
+#endif
+
+#include <dispatch/dispatch.h>
+#include <pthread.h>
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+struct thr_pool
+{
+    dispatch_queue_t        queue;
+    dispatch_group_t        group; /* group of spawned merges, or of asynchronous sort */
+#if _PMR_PARALLEL_MAY_SPAWN
+#if !_PMR_GCD_OVERCOMMIT
+    dispatch_semaphore_t    mutex; /* semaphore to prevent the threads overcommit flood */
+#endif
+#endif
+};
+
+#ifdef __PGI
+// PGI compiler __attribute__((__transparent_union__)) "hack"
+#define DISPATCH_OBJECT_T(o) ((dispatch_object_t){ (void *)(o) })
+#else
+#define DISPATCH_OBJECT_T(o) (o)
+#endif
 
 #if _PMR_QUEUE_OVERCOMMIT
 /*!
@@ -351,6 +917,8 @@ static dispatch_once_t _once;
 
     if (_ncpu <= 0)
         dispatch_once_f(&_once, NULL, __numCPU_initialize);
+    else
+        __numCPU_refresh();
 
     return (int)_ncpu;
 }
@@ -366,15 +934,33 @@ static dispatch_once_t _once;
 
 struct thr_pool
 {
-    size_t  ncpu;
+    size_t  ncpu;   /* number of threads of the team running the sort */
 };
 
+int pmergesort_workers(__unused const pmergesort_workers_t * workers)
+{
+    errno = ENOTSUP; /* see OMP_PROC_BIND and OMP_PLACES instead */
+    return -1;
+}
+
 /* -------------------------------------------------------------------------------------------------------------------------- */
 
 static inline int numCPU()
 {
     if (_ncpu <= 0)
-        _ncpu = omp_get_num_procs();
+    {
+        /* CPUs the process is allowed to run on */
+        int32_t ncpu = omp_get_num_procs();
+
+#ifdef __linux__
+        /* bandwidth limit of container */
+        int32_t quota = __numCPU_quota();
+        if (quota > 0 && quota < ncpu)
+            ncpu = quota;
+#endif
+
+        _ncpu = ncpu > 0 ? ncpu : 1;
+    }
 
     return (int)_ncpu;
 }
@@ -395,6 +981,12 @@ void pmergesort_nCPU(int32_t ncpu)
 }
 #endif
 
+int pmergesort_workers(__unused const pmergesort_workers_t * workers)
+{
+    errno = ENOTSUP; /* single-threaded */
+    return -1;
+}
+
 /* -------------------------------------------------------------------------------------------------------------------------- */
 #define numCPU()    (0)
 #define thPool()    ((thr_pool_t *)0)
@@ -419,6 +1011,9 @@ struct _aux
 
     size_t          sz;         /* size of temp. buffer */
     void *          temp;       /* temp. buffer storage */
+#if PMR_NUMA
+    int             home;       /* NUMA node of temp. buffer + 1, or 0 for regular allocation */
+#endif
 };
 typedef struct _aux aux_t;
 
@@ -453,10 +1048,33 @@ struct _context
     /* [sym]merge parallel wrapper */
 
     const void *    wsort;          /* sort function to wrap            */
+
+    /* [sym]merge parallel spawn */
+
+    struct _slab *  slab;           /* arena of spawn descriptors       */
+
+    /* comparator cost tuning */
+
+    unsigned int    cost;           /* cost of comparator call, ns (0 - unknown) */
+    size_t          grain;          /* min. number of elements per thread */
+    int             bshift;         /* scale of pre-sort block size (log2) */
+
+    /* asynchronous sort */
+
+    struct pmr_async *  async;      /* handle of asynchronous sort, or NULL */
+
+    /* cancellation */
+
+    const volatile int *    cancel;     /* cancellation token, or NULL */
+    uint64_t                deadline;   /* CLOCK_MONOTONIC time to give up at (ns), or 0 */
+
+    /* order */
+
+    int             desc;           /* sort in descending order (comparator arguments are swapped) */
 };
 typedef struct _context context_t;
 
-#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS || PMR_PARALLEL_USE_OMP
 struct _pmergesort_pass_context
 {
     context_t *     ctx;
@@ -466,8 +1084,8 @@ struct _pmergesort_pass_context
 
     size_t          chunksz;
     size_t          numchunks;
-#if PMR_PARALLEL_USE_PTHREADS
-    size_t          chunk;      /* index of chunk (for pthread model)   */
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS
+    size_t          chunk;      /* index of chunk (for pthread model and asynchronous sort) */
 #endif
 
     void *          lo;
@@ -480,6 +1098,184 @@ struct _pmergesort_pass_context
 typedef struct _pmergesort_pass_context pmergesort_pass_context_t;
 #endif
 
+struct _topk_context
+{
+    context_t *     ctx;
+
+    size_t          k;          /* number of least elements to select   */
+    size_t          chunksz;
+    size_t          numchunks;
+
+    aux_t *         auxes;      /* array of per-chunk aux data          */
+};
+typedef struct _topk_context topk_context_t;
+
+struct _select_segment
+{
+    void *          lo;
+    void *          hi;
+};
+typedef struct _select_segment select_segment_t;
+
+struct _select_context
+{
+    context_t *     ctx;
+
+    void *          pivot;      /* copy of pivot element                */
+    int             le;         /* elements equal to pivot go left      */
+    uint64_t        seed;       /* state of sample generator            */
+
+    void *          lo;         /* segment to partition                 */
+    void *          hi;
+
+    size_t          chunksz;
+    size_t          numchunks;
+    void **         mids;       /* array of split points of chunks      */
+
+    size_t          nmisplaced; /* number of elements to swap across    */
+    size_t          nshares;    /* number of jobs to swap them          */
+    select_segment_t *  lsegs;  /* right elements before split point    */
+    select_segment_t *  rsegs;  /* left elements after split point      */
+};
+typedef struct _select_context select_context_t;
+
+struct _merge_task
+{
+    void *          lo;
+    void *          mi;
+    void *          hi;
+};
+typedef struct _merge_task merge_task_t;
+
+struct _merge_runs_context
+{
+    context_t *     ctx;
+
+    merge_task_t *  tasks;      /* array of merges of level             */
+    merge_task_t *  halves;     /* array of merges split in halves      */
+    size_t          grain;      /* min. length of merge worth to split  */
+    volatile int    split;      /* some merge of level is split         */
+
+    int             inplace;    /* merge by SymMerge only               */
+
+    void *          dst;        /* output of k-way merge                */
+    size_t          nruns;
+    void **         bounds;     /* run bounds of parts, row per part    */
+    volatile int    rc;
+};
+typedef struct _merge_runs_context merge_runs_context_t;
+
+struct _compact_context
+{
+    context_t *     ctx;
+
+    int             (*deleted)(void * thunk, const void * elt);
+
+    size_t          chunksz;
+    size_t          numchunks;
+    void **         ends;       /* array of ends of kept elements of chunks */
+    void *          temp;       /* kept elements of chunks but the 1st one, or NULL to compact chunks in place */
+    size_t *        offs;       /* array of destinations of kept elements of chunks */
+};
+typedef struct _compact_context compact_context_t;
+
+struct _unique_context
+{
+    context_t *     ctx;
+
+    void            (*reduce)(void * thunk, void * acc, const void * dup);
+
+    size_t          na;         /* length of the 1st sorted half */
+    void *          temp;       /* output of merge of halves */
+
+    size_t          chunksz;
+    size_t          numchunks;
+    void **         starts;     /* array of starts of kept elements of chunks */
+    void **         ends;       /* array of ends of kept elements of chunks */
+    size_t *        offs;       /* array of destinations of kept elements of chunks */
+};
+typedef struct _unique_context unique_context_t;
+
+struct _presorted_context
+{
+    context_t *     ctx;
+
+    size_t          chunksz;
+    size_t          numchunks;
+    int *           order;      /* array of orders of chunks: 1 for non-descending, 2 for strictly descending, 3 for both */
+    volatile int    unordered;  /* a chunk has found both orders broken */
+};
+typedef struct _presorted_context presorted_context_t;
+
+struct _segmented_context
+{
+    context_t *     ctx;
+
+    const size_t *  offs;       /* segment i is [offs[i], offs[i + 1]) */
+    size_t *        bounds;     /* chunk i sorts segments [bounds[i], bounds[i + 1]) */
+    size_t          numchunks;
+    aux_t *         auxes;      /* temporary storage of chunks */
+    size_t          share;      /* longer segments are sorted after chunks */
+};
+typedef struct _segmented_context segmented_context_t;
+
+#if (PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS) && _PMR_PARALLEL_MAY_SPAWN
+union _slab_elt
+{
+    union _slab_elt *           next;       /* linked list of free descriptors      */
+    pmergesort_pass_context_t   pass_ctx;   /* spawn descriptor                     */
+};
+typedef union _slab_elt slab_elt_t;
+
+struct _slab_block
+{
+    struct _slab_block *        next;       /* linked list of blocks                */
+    slab_elt_t                  elts[_PMR_SLAB_NELTS];
+};
+typedef struct _slab_block slab_block_t;
+
+struct _slab
+{
+    pthread_mutex_t             mutex;      /* protects the arena data              */
+    slab_elt_t *                free;       /* head of free descriptors list        */
+    slab_block_t *              blocks;     /* list of allocated blocks             */
+};
+typedef struct _slab slab_t;
+#endif
+
+struct pmr_async
+{
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS
+    pthread_mutex_t             mutex;      /* protects the completion state        */
+    pthread_cond_t              cond;       /* signaled on completion               */
+#endif
+    int                         refs;       /* references of sort and caller        */
+    int                         done;       /* sort is completed                    */
+    int                         rc;         /* result code of sort                  */
+
+    void                        (*callback)(void * arg, int rc);
+    void *                      arg;
+
+    context_t                   ctx;        /* sort context                         */
+#if PMR_PARALLEL_USE_PTHREADS
+    thr_pool_t *                pool;       /* shared pool the sort runs on         */
+    void                        (*step)(void * async);  /* schedules the next pass */
+    volatile size_t             pending;    /* number of outstanding jobs of pass   */
+#elif PMR_PARALLEL_USE_GCD
+    thr_pool_t                  dispatch;   /* queue, group and semaphore of sort   */
+#endif
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS
+    int                         pass2;      /* merge pass is next                   */
+    size_t                      bsz;        /* block size of the next pass          */
+
+    aux_t *                     auxes;      /* array of per-chunk aux data          */
+    pmergesort_pass_context_t * pass_ctx;   /* array of per-chunk pass descriptors  */
+#if _PMR_PARALLEL_MAY_SPAWN
+    slab_t                      slab;       /* arena of spawn descriptors           */
+#endif
+#endif
+};
+
 /* -------------------------------------------------------------------------------------------------------------------------- */
 
 /* -------------------------------------------------------------------------------------------------------------------------- */
@@ -819,11 +1615,27 @@ static inline void _region_move_left(void * src, void * dst, size_t sz)
 /* allocate or adjust size of temporary storage if needed                                                                     */
 /* -------------------------------------------------------------------------------------------------------------------------- */
 
+#if PMR_NUMA
+#include "pmergesort-numa.inl"
+#endif
+
 static inline void * _aux_alloc(aux_t * aux, size_t sz)
 {
     void * tmp = aux->temp;
     if (tmp == NULL || aux->sz < sz)
     {
+#if PMR_NUMA
+        if (aux->home != 0)
+        {
+            /* content of temp. storage is not preserved, no need to remap */
+            if (tmp != NULL)
+                _numa_free(tmp, aux->sz);
+
+            aux->temp = NULL;
+            tmp = _numa_alloc(sz, aux->home - 1);
+        }
+        else
+#endif
         tmp = PMR_REALLOC(tmp, sz);
         if (tmp == NULL)
         {
@@ -843,87 +1655,409 @@ static inline void _aux_free(aux_t * aux)
 {
     if (aux->temp != NULL)
     {
+#if PMR_NUMA
+        if (aux->home != 0)
+            _numa_free(aux->temp, aux->sz);
+        else
+#endif
         PMR_FREE(aux->temp);
         aux->temp = NULL;
     }
 }
 
+#if PMR_NUMA
+/*
+ * make temporary storage local to node (-1 for any)
+ */
+static inline void _aux_rehome(aux_t * aux, int node)
+{
+    if (aux->home != node + 1)
+    {
+        _aux_free(aux); /* allocated for other node */
+        aux->home = node + 1;
+    }
+}
+#endif
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/* slab arena of spawn descriptors, descriptors are recycled within the sort and released at once at the end of sort          */
 /* -------------------------------------------------------------------------------------------------------------------------- */
 
-#define IDIV_UP(N, M)               ({ __typeof__(N) __n = (N); __typeof__(M) __m = (M); (__n + (__m - 1)) / __m; })
-#define ISIGN(V)                    ({ __typeof__(V) __v = (V); ((__v > 0) - (__v < 0)); })
+#if (PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS) && _PMR_PARALLEL_MAY_SPAWN
+static inline void _slab_init(slab_t * slab)
+{
+    (void)pthread_mutex_init(&slab->mutex, NULL);
+    slab->free = NULL;
+    slab->blocks = NULL;
+}
 
-#define ELT_PTR_FWD(ctx, base, inx) ELT_PTR_FWD_((base), (inx), ELT_SZ(ctx))
-#define ELT_PTR_BCK(ctx, base, inx) ELT_PTR_BCK_((base), (inx), ELT_SZ(ctx))
-#define ELT_PTR_NEXT(ctx, base)     (((void *)(base)) + ELT_SZ(ctx))
-#define ELT_PTR_PREV(ctx, base)     (((void *)(base)) - ELT_SZ(ctx))
-#define ELT_DIST(ctx, a, b)         ELT_DIST_((a), (b), ELT_SZ(ctx))
+static inline void _slab_destroy(slab_t * slab)
+{
+    slab_block_t * block;
+    while ((block = slab->blocks) != NULL)
+    {
+        slab->blocks = block->next;
+        PMR_FREE(block);
+    }
 
-#define MAKE_STR0(x, y)             x ## y
-#define MAKE_STR1(x, y)             MAKE_STR0(x, y)
-#define MAKE_FNAME0(x, y)           _ ## x ## _ ## y
-#define MAKE_FNAME1(x, y)           MAKE_FNAME0(x, y)
-#define _M(name)                    MAKE_FNAME1(name, SORT_SUFFIX)
-#define _F(name)                    MAKE_STR1(name, SORT_IS_R)
-#define _(name)                     MAKE_FNAME1(name, MAKE_STR1(SORT_SUFFIX, SORT_IS_R))
+    slab->free = NULL;
 
-/* -------------------------------------------------------------------------------------------------------------------------- */
+    (void)pthread_mutex_destroy(&slab->mutex);
+}
 
-#if _PMR_USE_4_MEM
+static inline pmergesort_pass_context_t * _slab_alloc(slab_t * slab)
+{
+    slab_elt_t * elt;
 
-#define SORT_SUFFIX                 4
+    (void)pthread_mutex_lock(&slab->mutex);
 
-#define ELT_OF_SZ(n, sz)            ((n) << 2)
-#define ELT_PTR_FWD_(base, inx, sz) ({ __typeof__(inx) __inx = (inx); ((void *)(base)) + (__inx << 2); })
-#define ELT_PTR_BCK_(base, inx, sz) ({ __typeof__(inx) __inx = (inx); ((void *)(base)) - (__inx << 2); })
-#define ELT_DIST_(a, b, sz)         ((((void *)(a)) - ((void *)(b))) >> 2)
+    if ((elt = slab->free) != NULL)
+    {
+        slab->free = elt->next;
 
-#define ELT_TYPE                    uint32_t
-#include "pmergesort-mem-n.inl"
+        _PMR_STAT_INC(spawns_reused);
+    }
+    else
+    {
+        slab_block_t * block = PMR_MALLOC(sizeof(slab_block_t));
+        if (block != NULL)
+        {
+            block->next = slab->blocks;
+            slab->blocks = block;
 
-#include "pmergesort-mem.inl"
+            /* the 1st element goes to caller, the rest is to free list */
+            for (size_t i = 1; i < _PMR_SLAB_NELTS - 1; i++)
+                block->elts[i].next = &block->elts[i + 1];
+            block->elts[_PMR_SLAB_NELTS - 1].next = NULL;
+            slab->free = &block->elts[1];
 
-#undef ELT_TYPE
-#undef ELT_DIST_
-#undef ELT_PTR_FWD_
-#undef ELT_PTR_BCK_
-#undef ELT_OF_SZ
+            elt = &block->elts[0];
 
-#undef SORT_SUFFIX
+            _PMR_STAT_INC(spawns_allocated);
+        }
+    }
 
-#endif
+    (void)pthread_mutex_unlock(&slab->mutex);
 
-/* -------------------------------------------------------------------------------------------------------------------------- */
+    return elt != NULL ? &elt->pass_ctx : NULL;
+}
 
-#if _PMR_USE_8_MEM
+static inline void _slab_free(slab_t * slab, pmergesort_pass_context_t * pass_ctx)
+{
+    slab_elt_t * elt = (slab_elt_t *)pass_ctx;
 
-#define SORT_SUFFIX                 8
+    (void)pthread_mutex_lock(&slab->mutex);
 
-#define ELT_OF_SZ(n, sz)            ((n) << 3)
-#define ELT_PTR_FWD_(base, inx, sz) ({ __typeof__(inx) __inx = (inx); ((void *)(base)) + (__inx << 3); })
-#define ELT_PTR_BCK_(base, inx, sz) ({ __typeof__(inx) __inx = (inx); ((void *)(base)) - (__inx << 3); })
-#define ELT_DIST_(a, b, sz)         ((((void *)(a)) - ((void *)(b))) >> 3)
+    elt->next = slab->free;
+    slab->free = elt;
 
-#if __LP64__
-#define ELT_TYPE                    uint64_t
-#include "pmergesort-mem-n.inl"
-#else
-#include "pmergesort-mem-sz.inl"
+    (void)pthread_mutex_unlock(&slab->mutex);
+}
 #endif
 
-#include "pmergesort-mem.inl"
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/* tune spawn cut-off, parallel grain and block size by the cost of comparator call (ns, 0 - unknown)                         */
+/*                                                                                                                            */
+/* the fixed thresholds are tuned for a cheap comparator, the slower it is the smaller pieces of work are worth of a thread  */
+/* -------------------------------------------------------------------------------------------------------------------------- */
 
-#undef ELT_TYPE
-#undef ELT_DIST_
-#undef ELT_PTR_FWD_
-#undef ELT_PTR_BCK_
-#undef ELT_OF_SZ
+static inline void tuneCost(context_t * ctx, unsigned int cost)
+{
+    /* slowness of comparator relatively to reference one, in quarters */
+    size_t q = cost != 0 ? ((size_t)cost << 2) / _PMR_CMP_COST_REF : 4;
+    if (q < 1)
+        q = 1;
+    else if (q > 256)
+        q = 256;
 
-#undef SORT_SUFFIX
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS || PMR_PARALLEL_USE_OMP
+    size_t cut_off = (ctx->cut_off << 2) / q;
+    ctx->cut_off = cut_off > _PMR_BLOCKLEN_MTHRESHOLD * _PMR_BLOCKLEN_SYMMERGE ? cut_off : _PMR_BLOCKLEN_MTHRESHOLD * _PMR_BLOCKLEN_SYMMERGE;
 
+    size_t grain = ((size_t)_PMR_PARALLEL_GRAIN << 2) / q;
+    ctx->grain = grain > _PMR_BLOCKLEN_MTHRESHOLD * _PMR_BLOCKLEN_MERGE ? grain : _PMR_BLOCKLEN_MTHRESHOLD * _PMR_BLOCKLEN_MERGE;
 #endif
 
-/* -------------------------------------------------------------------------------------------------------------------------- */
+    /* binary insertion sort spends less on comparisons than merge levels do, favor longer blocks for slow comparator */
+    ctx->bshift = q >= 64 ? 2 : (q >= 16 ? 1 : 0);
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/* cancellation: the token and the deadline are checked by block and by spawn, the sort bails out as on error               */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+static inline uint64_t _now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t _deadline(const pmr_options_t * opts)
+{
+    return opts != NULL && opts->timeout_ms != 0 ? _now() + (uint64_t)opts->timeout_ms * 1000000ULL : 0;
+}
+
+/*
+ * returns non-zero and sets the result code of aux (may be NULL) if the sort is to be given up
+ */
+static inline int _cancelled(const context_t * ctx, aux_t * aux)
+{
+    int rc = 0;
+    if (ctx->cancel != NULL && *ctx->cancel != 0)
+        rc = PMR_ECANCELED;
+    else if (ctx->deadline != 0 && _now() >= ctx->deadline)
+        rc = PMR_ETIMEDOUT;
+
+    if (rc != 0 && aux != NULL)
+        aux->rc = rc;
+
+    return rc;
+}
+
+/*
+ * options (may be NULL) ask for descending order
+ */
+static inline int _opts_desc(const pmr_options_t * opts)
+{
+    return opts != NULL && (opts->flags & PMR_DESCENDING) != 0;
+}
+
+/*
+ * context of call on array, thpool is NULL for no spawn; options (may be NULL) set cost of comparator, give up and order
+ */
+static inline context_t _ctx_init(const void * base, size_t n, size_t sz, const void * cmp, const void * thunk, thr_pool_t * thpool, const pmr_options_t * opts)
+{
+    context_t ctx =
+    {
+        .base = base, .n = n, .sz = sz, .cmp = cmp, .thunk = thunk,
+        .ncpu = numCPU(), .thpool = thpool, .cut_off = n >= 2 ? cutOff(n) : 0,
+        .cost = opts != NULL ? opts->cmp_cost : 0,
+        .cancel = opts != NULL ? opts->cancel : NULL,
+        .deadline = _deadline(opts),
+        .desc = _opts_desc(opts)
+    };
+
+    return ctx;
+}
+
+/*
+ * context of sub-array [base, base + n) of call, inherits comparator, threads, cost, give up and order of ctx
+ */
+static inline context_t _ctx_sub(const context_t * ctx, const void * base, size_t n, thr_pool_t * thpool)
+{
+    context_t sub =
+    {
+        .base = base, .n = n, .sz = ctx->sz, .cmp = ctx->cmp, .thunk = ctx->thunk,
+        .ncpu = ctx->ncpu, .thpool = thpool, .cut_off = n >= 2 ? cutOff(n) : 0,
+        .cost = ctx->cost,
+        .cancel = ctx->cancel,
+        .deadline = ctx->deadline,
+        .desc = ctx->desc
+    };
+
+    return sub;
+}
+
+/*
+ * returns 0 if ranks of selection are ascending and in range, or -1 with errno set
+ */
+static inline int _select_ranks(size_t n, const size_t * ks, size_t nks)
+{
+    for (size_t i = 0; i < nks; i++)
+    {
+        if (ks[i] >= n || (i != 0 && ks[i] < ks[i - 1]))
+        {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * returns 0 if offsets of runs are ascending, or -1 with errno set
+ */
+static inline int _runs_check(const size_t * offs, size_t nruns)
+{
+    for (size_t i = 0; i < nruns; i++)
+    {
+        if (offs[i + 1] < offs[i])
+        {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/* asynchronous sort: completion and release of handle                                                                        */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+static void _async_unref(pmr_async_t * async)
+{
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS
+    if (__sync_sub_and_fetch(&async->refs, 1) != 0)
+        return;
+
+    (void)pthread_cond_destroy(&async->cond);
+    (void)pthread_mutex_destroy(&async->mutex);
+#else
+    if (--async->refs != 0)
+        return;
+#endif
+
+    PMR_FREE(async);
+}
+
+static void _async_complete(pmr_async_t * async, int rc)
+{
+#if PMR_PARALLEL_USE_PTHREADS
+    thr_pool_t * pool = async->pool;
+#endif
+
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS
+    for (int i = 0; i < async->ctx.ncpu; i++)
+    {
+        _aux_free(&async->auxes[i]);
+
+        if (rc == 0)
+            rc = async->auxes[i].rc;
+    }
+
+#if _PMR_PARALLEL_MAY_SPAWN
+    _slab_destroy(&async->slab);
+#endif
+#endif
+
+#if PMR_PARALLEL_USE_GCD
+    dispatch_release(DISPATCH_OBJECT_T(async->dispatch.group));
+#if _PMR_PARALLEL_MAY_SPAWN && !_PMR_GCD_OVERCOMMIT
+    dispatch_release(DISPATCH_OBJECT_T(async->dispatch.mutex));
+#endif
+#endif
+
+    if (async->callback != NULL)
+        async->callback(async->arg, rc);
+
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS
+    (void)pthread_mutex_lock(&async->mutex);
+    async->rc = rc;
+    async->done = 1;
+    (void)pthread_cond_broadcast(&async->cond);
+    (void)pthread_mutex_unlock(&async->mutex);
+#else
+    async->rc = rc;
+    async->done = 1;
+#endif
+
+    _async_unref(async);
+
+#if PMR_PARALLEL_USE_PTHREADS
+    asyncPool_release(pool);
+#endif
+}
+
+#if PMR_PARALLEL_USE_PTHREADS
+/*
+ * account a job of the current pass (spawned one as well)
+ */
+static inline void _async_hold(pmr_async_t * async)
+{
+    if (async != NULL)
+        (void)__sync_add_and_fetch(&async->pending, 1);
+}
+
+/*
+ * the last finished job of pass runs the continuation
+ */
+static inline void _async_release(pmr_async_t * async)
+{
+    if (async != NULL && __sync_sub_and_fetch(&async->pending, 1) == 0)
+        async->step(async);
+}
+#endif
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+#define IDIV_UP(N, M)               ({ __typeof__(N) __n = (N); __typeof__(M) __m = (M); (__n + (__m - 1)) / __m; })
+#define ISIGN(V)                    ({ __typeof__(V) __v = (V); ((__v > 0) - (__v < 0)); })
+
+#define ELT_PTR_FWD(ctx, base, inx) ELT_PTR_FWD_((base), (inx), ELT_SZ(ctx))
+#define ELT_PTR_BCK(ctx, base, inx) ELT_PTR_BCK_((base), (inx), ELT_SZ(ctx))
+#define ELT_PTR_NEXT(ctx, base)     (((void *)(base)) + ELT_SZ(ctx))
+#define ELT_PTR_PREV(ctx, base)     (((void *)(base)) - ELT_SZ(ctx))
+#define ELT_DIST(ctx, a, b)         ELT_DIST_((a), (b), ELT_SZ(ctx))
+
+#define MAKE_STR0(x, y)             x ## y
+#define MAKE_STR1(x, y)             MAKE_STR0(x, y)
+#define MAKE_FNAME0(x, y)           _ ## x ## _ ## y
+#define MAKE_FNAME1(x, y)           MAKE_FNAME0(x, y)
+#define _M(name)                    MAKE_FNAME1(name, SORT_SUFFIX)
+#define _F(name)                    MAKE_STR1(name, SORT_IS_R)
+#define _(name)                     MAKE_FNAME1(name, MAKE_STR1(SORT_SUFFIX, SORT_IS_R))
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+#if _PMR_USE_4_MEM
+
+#define SORT_SUFFIX                 4
+
+#define ELT_OF_SZ(n, sz)            ((n) << 2)
+#define ELT_PTR_FWD_(base, inx, sz) ({ __typeof__(inx) __inx = (inx); ((void *)(base)) + (__inx << 2); })
+#define ELT_PTR_BCK_(base, inx, sz) ({ __typeof__(inx) __inx = (inx); ((void *)(base)) - (__inx << 2); })
+#define ELT_DIST_(a, b, sz)         ((((void *)(a)) - ((void *)(b))) >> 2)
+
+#define ELT_TYPE                    uint32_t
+#include "pmergesort-mem-n.inl"
+
+#include "pmergesort-mem.inl"
+
+#undef ELT_TYPE
+#undef ELT_DIST_
+#undef ELT_PTR_FWD_
+#undef ELT_PTR_BCK_
+#undef ELT_OF_SZ
+
+#undef SORT_SUFFIX
+
+#endif
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+#if _PMR_USE_8_MEM
+
+#define SORT_SUFFIX                 8
+
+#define ELT_OF_SZ(n, sz)            ((n) << 3)
+#define ELT_PTR_FWD_(base, inx, sz) ({ __typeof__(inx) __inx = (inx); ((void *)(base)) + (__inx << 3); })
+#define ELT_PTR_BCK_(base, inx, sz) ({ __typeof__(inx) __inx = (inx); ((void *)(base)) - (__inx << 3); })
+#define ELT_DIST_(a, b, sz)         ((((void *)(a)) - ((void *)(b))) >> 3)
+
+#if __LP64__
+#define ELT_TYPE                    uint64_t
+#include "pmergesort-mem-n.inl"
+#else
+#include "pmergesort-mem-sz.inl"
+#endif
+
+#include "pmergesort-mem.inl"
+
+#undef ELT_TYPE
+#undef ELT_DIST_
+#undef ELT_PTR_FWD_
+#undef ELT_PTR_BCK_
+#undef ELT_OF_SZ
+
+#undef SORT_SUFFIX
+
+#endif
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
 
 #if _PMR_USE_16_MEM
 
@@ -968,6 +2102,50 @@ static inline void _aux_free(aux_t * aux)
 /* -------------------------------------------------------------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------------------------------------------------------- */
 
+#include "pmergesort-extsort.inl"
+#include "pmergesort-stream.inl"
+#include "pmergesort-keys.inl"
+#include "pmergesort-str.inl"
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+/*
+ * comparator of descending order handed to wrapped sort, the thunk is the context
+ */
+static int _cmp_desc_r(void * thunk, const void * a, const void * b)
+{
+    const context_t * ctx = thunk;
+
+    return ((cmpr_t)ctx->cmp)((void *)ctx->thunk, b, a);
+}
+
+/*
+ * comparator of plain interface called through reentrant one, the thunk is the comparator
+ */
+static int _cmp_v_r(void * thunk, const void * a, const void * b)
+{
+    return ((cmpv_t)thunk)(a, b);
+}
+
+/* descending order: reentrant instantiation with swapped arguments of comparator, the calls with options pick it once per   */
+/* call (the plain ones through _cmp_v_r), so the comparator calls of ascending instantiations do not test the order         */
+
+#define SORT_IS_R                   rd
+#define CALL_CMP(ctx, a, b)         ((cmpr_t)((ctx)->cmp))((void *)(ctx)->thunk, (b), (a))
+#define CALL_SORT(ctx, a, n)        ((sort_r_t)((ctx)->wsort))((a), (n), (ctx)->sz, (void *)(ctx), _cmp_desc_r)
+
+#include "pmergesort.inl"
+
+#undef CALL_SORT
+#undef CALL_CMP
+#undef SORT_IS_R
+
+#define _D(ctx, name)               ((ctx)->desc ? MAKE_STR1(name, rd) : _F(name)) /* function of order of context */
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
 #define SORT_IS_R                   v
 #define CALL_CMP(ctx, a, b)         ((cmpv_t)((ctx)->cmp))((a), (b))
 #define CALL_SORT(ctx, a, n)        ((sort_t)((ctx)->wsort))((a), (n), (ctx)->sz, (cmpv_t)(ctx)->cmp)
@@ -982,9 +2160,9 @@ void symmergesort(void * base, size_t n, size_t sz, int (*cmp)(const void *, con
     if (n < 2) /* have nothing to sort */
         return;
 
-    context_t ctx = { base, n, sz, cmp, NULL, numCPU(), thPool(), 0, 0, cutOff(n), NULL, NULL, NULL };
+    context_t ctx = _ctx_init(base, n, sz, cmp, NULL, thPool(), NULL);
 
-    _F(symmergesort)(&ctx);
+    (void)_F(symmergesort)(&ctx);
 }
 
 int pmergesort(void * base, size_t n, size_t sz, int (*cmp)(const void *, const void *))
@@ -992,7 +2170,7 @@ int pmergesort(void * base, size_t n, size_t sz, int (*cmp)(const void *, const
     if (n < 2) /* have nothing to sort */
         return 0;
 
-    context_t ctx = { base, n, sz, cmp, NULL, numCPU(), thPool(), 0, 0, cutOff(n), NULL, NULL, NULL };
+    context_t ctx = _ctx_init(base, n, sz, cmp, NULL, thPool(), NULL);
 
     return _F(pmergesort)(&ctx);
 }
@@ -1002,80 +2180,295 @@ int wrapmergesort(void * base, size_t n, size_t sz, int (*cmp)(const void *, con
     if (n < 2) /* have nothing to sort */
         return 0;
 
-    context_t ctx = { base, n, sz, cmp, NULL, numCPU(), thPool(), 0, 0, cutOff(n), NULL, NULL, sort };
+    context_t ctx = _ctx_init(base, n, sz, cmp, NULL, thPool(), NULL);
+    ctx.wsort = sort;
 
     return _F(wrapmergesort)(&ctx);
 }
 
-#if _PMR_CORE_PROFILE
-void insertionsort(void * base, size_t n, size_t sz, int (*cmp)(const void *, const void *))
+int pmergesort_topk(void * base, size_t n, size_t sz, size_t k, int (*cmp)(const void *, const void *))
 {
-    if (n < 2) /* have nothing to sort */
-        return;
+    if (n < 2 || k == 0) /* have nothing to sort */
+        return 0;
 
-    context_t ctx = { base, n, sz, cmp, NULL, 0, NULL, 0, 0, 0, NULL, NULL, NULL };
+    context_t ctx = _ctx_init(base, n, sz, cmp, NULL, thPool(), NULL);
 
-    _F(insertionsort)(&ctx);
+    return _F(pmergesort_topk)(&ctx, k);
 }
-#endif
 
-#if _PMR_CORE_PROFILE
-void insertionsort_run(void * base, size_t n, size_t sz, int (*cmp)(const void *, const void *))
+int pmr_select(void * base, size_t n, size_t sz, size_t k, int (*cmp)(const void *, const void *))
 {
-    if (n < 2) /* have nothing to sort */
-        return;
-
-    context_t ctx = { base, n, sz, cmp, NULL, 0, NULL, 0, 0, 0, NULL, NULL, NULL };
-
-    _F(insertionsort_run)(&ctx);
+    return pmr_select_multi(base, n, sz, &k, 1, cmp);
 }
-#endif
 
-#if _PMR_CORE_PROFILE
-void insertionsort_mergerun(void * base, size_t n, size_t sz, int (*cmp)(const void *, const void *))
+int pmr_select_multi(void * base, size_t n, size_t sz, const size_t * ks, size_t nks, int (*cmp)(const void *, const void *))
 {
-    if (n < 2) /* have nothing to sort */
-        return;
-
-    context_t ctx = { base, n, sz, cmp, NULL, 0, NULL, 0, 0, 0, NULL, NULL, NULL };
+    if (_select_ranks(n, ks, nks) != 0)
+        return -1;
 
-    _F(insertionsort_mergerun)(&ctx);
-}
-#endif
+    if (n < 2 || nks == 0) /* have nothing to select */
+        return 0;
 
-/* -------------------------------------------------------------------------------------------------------------------------- */
+    context_t ctx = _ctx_init(base, n, sz, cmp, NULL, thPool(), NULL);
 
-#undef CALL_SORT
-#undef CALL_CMP
-#undef SORT_IS_R
+    return _F(pmr_select)(&ctx, ks, nks);
+}
 
-/* -------------------------------------------------------------------------------------------------------------------------- */
-/* -------------------------------------------------------------------------------------------------------------------------- */
+int pmr_merge_runs(void * base, const size_t * run_offsets, size_t nruns, size_t sz, int (*cmp)(const void *, const void *))
+{
+    if (_runs_check(run_offsets, nruns) != 0)
+        return -1;
 
-#define SORT_IS_R                   r
-#define CALL_CMP(ctx, a, b)         ((cmpr_t)((ctx)->cmp))((void *)(ctx)->thunk, (a), (b))
-#define CALL_SORT(ctx, a, n)        ((sort_r_t)((ctx)->wsort))((a), (n), (ctx)->sz, (void *)(ctx)->thunk, (cmpr_t)(ctx)->cmp)
+    if (nruns < 2) /* have nothing to merge */
+        return 0;
 
-#include "pmergesort.inl"
+    context_t ctx = _ctx_init(base + run_offsets[0] * sz, run_offsets[nruns] - run_offsets[0], sz, cmp, NULL, NULL, NULL);
 
-/* -------------------------------------------------------------------------------------------------------------------------- */
+    return _F(merge_runs)(&ctx, run_offsets, nruns, 0);
+}
 
-void symmergesort_r(void * base, size_t n, size_t sz, void * thunk, int (*cmp)(void *, const void *, const void *))
+int pmr_kway_merge(void * dst, const void * base, const size_t * run_offsets, size_t nruns, size_t sz, int (*cmp)(const void *, const void *))
 {
-    if (n < 2) /* have nothing to sort */
-        return;
+    if (_runs_check(run_offsets, nruns) != 0)
+        return -1;
 
-    context_t ctx = { base, n, sz, cmp, thunk, numCPU(), thPool(), 0, 0, cutOff(n), NULL, NULL, NULL };
+    if (nruns == 0) /* have nothing to merge */
+        return 0;
+
+    context_t ctx = _ctx_init(base + run_offsets[0] * sz, run_offsets[nruns] - run_offsets[0], sz, cmp, NULL, NULL, NULL);
 
-    _F(symmergesort)(&ctx);
+    return _F(kway_merge_runs)(&ctx, dst, run_offsets, nruns);
 }
 
-int pmergesort_r(void * base, size_t n, size_t sz, void * thunk, int (*cmp)(void *, const void *, const void *))
+int pmr_sort_appended(void * base, size_t n_sorted, size_t n_total, size_t sz, int (*cmp)(const void *, const void *))
 {
-    if (n < 2) /* have nothing to sort */
+    if (n_sorted > n_total)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (n_sorted == n_total) /* have nothing to sort */
+        return 0;
+
+    context_t ctx = _ctx_init(base, n_total, sz, cmp, NULL, thPool(), NULL);
+
+    return _F(sort_appended)(&ctx, n_sorted, 0);
+}
+
+size_t pmr_sort_unique(void * base, size_t n, size_t sz, int (*cmp)(const void *, const void *))
+{
+    if (n < 2) /* have nothing to sort */
+        return n;
+
+    context_t ctx = _ctx_init(base, n, sz, cmp, NULL, thPool(), NULL);
+
+    size_t m;
+    if (_F(sort_unique)(&ctx, NULL, &m) != 0)
+    {
+        errno = ENOMEM;
+        return (size_t)-1;
+    }
+
+    return m;
+}
+
+int pmr_segmented_sort(void * base, const size_t * offsets, size_t nsegments, size_t sz, int (*cmp)(const void *, const void *))
+{
+    if (_runs_check(offsets, nsegments) != 0)
+        return -1;
+
+    size_t n = nsegments > 0 ? offsets[nsegments] - offsets[0] : 0;
+    if (n < 2) /* have nothing to sort */
+        return 0;
+
+    context_t ctx = _ctx_init(base + offsets[0] * sz, n, sz, cmp, NULL, thPool(), NULL);
+
+    return _F(segmented_sort)(&ctx, offsets, nsegments);
+}
+
+int pmr_extsort(const char * src, const char * dst, size_t sz, int (*cmp)(const void *, const void *), const pmr_options_t * opts)
+{
+    if (src == NULL || dst == NULL || sz == 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    context_t ctx = _opts_desc(opts) ? _ctx_init(NULL, 0, sz, _cmp_v_r, cmp, thPool(), opts) : _ctx_init(NULL, 0, sz, cmp, NULL, thPool(), opts);
+    extsort_t es = { &ctx, _D(&ctx, pmergesort), _D(&ctx, symmergesort), _D(&ctx, kway_merge_spans), _D(&ctx, kway_cut), opts != NULL && opts->mem_budget != 0 ? opts->mem_budget : _PMR_EXTSORT_BUDGET, opts != NULL ? opts->tmpdir : NULL };
+
+    return _extsort_result(_extsort(&es, src, dst));
+}
+
+int pmr_sort_file(const char * path, size_t sz, int (*cmp)(const void *, const void *), const pmr_options_t * opts)
+{
+    if (path == NULL || sz == 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    void * base;
+    size_t n;
+
+    int fd = _mapfile_open(path, sz, &base, &n);
+    if (fd < 0)
+        return -1;
+
+    int rc = 0;
+    if (n >= 2)
+    {
+        context_t ctx = _opts_desc(opts) ? _ctx_init(base, n, sz, _cmp_v_r, cmp, thPool(), opts) : _ctx_init(base, n, sz, cmp, NULL, thPool(), opts);
+
+        rc = _extsort_rc(_mapfile_inplace(n, sz, opts) ? _D(&ctx, symmergesort)(&ctx) : _D(&ctx, pmergesort)(&ctx));
+    }
+
+    return _extsort_result(_mapfile_close(fd, base, n * sz, rc));
+}
+
+int pmr_sort_by_key(void * keys, size_t n, size_t key_sz, int (*cmp)(const void *, const void *),
+                        void * const * payloads, const size_t * payload_sz, size_t npayloads)
+{
+    if (n < 2) /* have nothing to sort */
         return 0;
 
-    context_t ctx = { base, n, sz, cmp, thunk, numCPU(), thPool(), 0, 0, cutOff(n), NULL, NULL, NULL };
+    bykey_t bk;
+    if (_bykey_open(&bk, keys, n, key_sz) != 0)
+        return 1;
+
+    context_t ctx = _ctx_init(bk.recs, n, bk.rsz, cmp, NULL, thPool(), NULL);
+
+    int rc = _F(pmergesort)(&ctx);
+    if (rc != 0)
+    {
+        PMR_FREE(bk.recs);
+        return rc;
+    }
+
+    return _bykey_close(&bk, payloads, payload_sz, npayloads);
+}
+
+#if _PMR_CORE_PROFILE
+void insertionsort(void * base, size_t n, size_t sz, int (*cmp)(const void *, const void *))
+{
+    if (n < 2) /* have nothing to sort */
+        return;
+
+    context_t ctx = { .base = base, .n = n, .sz = sz, .cmp = cmp }; /* no threads */
+
+    _F(insertionsort)(&ctx);
+}
+#endif
+
+#if _PMR_CORE_PROFILE
+void insertionsort_run(void * base, size_t n, size_t sz, int (*cmp)(const void *, const void *))
+{
+    if (n < 2) /* have nothing to sort */
+        return;
+
+    context_t ctx = { .base = base, .n = n, .sz = sz, .cmp = cmp }; /* no threads */
+
+    _F(insertionsort_run)(&ctx);
+}
+#endif
+
+#if _PMR_CORE_PROFILE
+void insertionsort_mergerun(void * base, size_t n, size_t sz, int (*cmp)(const void *, const void *))
+{
+    if (n < 2) /* have nothing to sort */
+        return;
+
+    context_t ctx = { .base = base, .n = n, .sz = sz, .cmp = cmp }; /* no threads */
+
+    _F(insertionsort_mergerun)(&ctx);
+}
+#endif
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+#undef CALL_SORT
+#undef CALL_CMP
+#undef SORT_IS_R
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+/* cached key prefixes: the core of 16 byte pairs only, with the prefixes compared inline and the comparator of records     */
+/* called on ties (see pmergesort-keys.inl), the wrapped sort gets the same order through _prefix_cmp                        */
+
+#define SORT_IS_R                   p
+#define CALL_CMP(ctx, a, b)         _prefix_pair_cmp((ctx), (a), (b))
+#define CALL_SORT(ctx, a, n)        ((sort_r_t)((ctx)->wsort))((a), (n), (ctx)->sz, (void *)(ctx)->thunk, _prefix_cmp)
+
+#if _PMR_USE_16_MEM
+
+#define SORT_SUFFIX                 16
+
+#define ELT_SZ(ctx)                 16
+#define ELT_OF_SZ(n, sz)            ((n) << 4)
+#define ELT_PTR_FWD_(base, inx, sz) ({ __typeof__(inx) __inx = (inx); ((void *)(base)) + (__inx << 4); })
+#define ELT_PTR_BCK_(base, inx, sz) ({ __typeof__(inx) __inx = (inx); ((void *)(base)) - (__inx << 4); })
+#define ELT_DIST_(a, b, sz)         ((((void *)(a)) - ((void *)(b))) >> 4)
+
+#else
+
+#define SORT_SUFFIX                 sz
+
+#define ELT_SZ(ctx)                 (ctx)->sz
+#define ELT_OF_SZ(n, sz)            ((sz) * (n))
+#define ELT_PTR_FWD_(base, inx, sz) (((void *)(base)) + (sz) * (inx))
+#define ELT_PTR_BCK_(base, inx, sz) (((void *)(base)) - (sz) * (inx))
+#define ELT_DIST_(a, b, sz)         ((((void *)(a)) - ((void *)(b))) / (sz))
+
+#endif
+
+#include "pmergesort-core.inl"
+
+static inline int _prefix_pmergesort(context_t * ctx)
+{
+    return _(pmergesort)(ctx);
+}
+
+#undef ELT_DIST_
+#undef ELT_PTR_FWD_
+#undef ELT_PTR_BCK_
+#undef ELT_OF_SZ
+#undef ELT_SZ
+
+#undef SORT_SUFFIX
+
+#undef CALL_SORT
+#undef CALL_CMP
+#undef SORT_IS_R
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+#define SORT_IS_R                   r
+#define CALL_CMP(ctx, a, b)         ((cmpr_t)((ctx)->cmp))((void *)(ctx)->thunk, (a), (b))
+#define CALL_SORT(ctx, a, n)        ((sort_r_t)((ctx)->wsort))((a), (n), (ctx)->sz, (void *)(ctx)->thunk, (cmpr_t)(ctx)->cmp)
+
+#include "pmergesort.inl"
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+void symmergesort_r(void * base, size_t n, size_t sz, void * thunk, int (*cmp)(void *, const void *, const void *))
+{
+    if (n < 2) /* have nothing to sort */
+        return;
+
+    context_t ctx = _ctx_init(base, n, sz, cmp, thunk, thPool(), NULL);
+
+    (void)_F(symmergesort)(&ctx);
+}
+
+int pmergesort_r(void * base, size_t n, size_t sz, void * thunk, int (*cmp)(void *, const void *, const void *))
+{
+    if (n < 2) /* have nothing to sort */
+        return 0;
+
+    context_t ctx = _ctx_init(base, n, sz, cmp, thunk, thPool(), NULL);
 
     return _F(pmergesort)(&ctx);
 }
@@ -1085,11 +2478,463 @@ int wrapmergesort_r(void * base, size_t n, size_t sz, void * thunk, int (*cmp)(v
     if (n < 2) /* have nothing to sort */
         return 0;
 
-    context_t ctx = { base, n, sz, cmp, thunk, numCPU(), thPool(), 0, 0, cutOff(n), NULL, NULL, sort_r };
+    context_t ctx = _ctx_init(base, n, sz, cmp, thunk, thPool(), NULL);
+    ctx.wsort = sort_r;
 
     return _F(wrapmergesort)(&ctx);
 }
 
+int pmergesort_topk_r(void * base, size_t n, size_t sz, size_t k, void * thunk, int (*cmp)(void *, const void *, const void *))
+{
+    if (n < 2 || k == 0) /* have nothing to sort */
+        return 0;
+
+    context_t ctx = _ctx_init(base, n, sz, cmp, thunk, thPool(), NULL);
+
+    return _F(pmergesort_topk)(&ctx, k);
+}
+
+int pmr_select_r(void * base, size_t n, size_t sz, size_t k, void * thunk, int (*cmp)(void *, const void *, const void *))
+{
+    return pmr_select_multi_r(base, n, sz, &k, 1, thunk, cmp);
+}
+
+int pmr_select_multi_r(void * base, size_t n, size_t sz, const size_t * ks, size_t nks, void * thunk, int (*cmp)(void *, const void *, const void *))
+{
+    if (_select_ranks(n, ks, nks) != 0)
+        return -1;
+
+    if (n < 2 || nks == 0) /* have nothing to select */
+        return 0;
+
+    context_t ctx = _ctx_init(base, n, sz, cmp, thunk, thPool(), NULL);
+
+    return _F(pmr_select)(&ctx, ks, nks);
+}
+
+int pmr_merge_runs_r(void * base, const size_t * run_offsets, size_t nruns, size_t sz, void * thunk, int (*cmp)(void *, const void *, const void *))
+{
+    if (_runs_check(run_offsets, nruns) != 0)
+        return -1;
+
+    if (nruns < 2) /* have nothing to merge */
+        return 0;
+
+    context_t ctx = _ctx_init(base + run_offsets[0] * sz, run_offsets[nruns] - run_offsets[0], sz, cmp, thunk, NULL, NULL);
+
+    return _F(merge_runs)(&ctx, run_offsets, nruns, 0);
+}
+
+int pmr_kway_merge_r(void * dst, const void * base, const size_t * run_offsets, size_t nruns, size_t sz, void * thunk, int (*cmp)(void *, const void *, const void *))
+{
+    if (_runs_check(run_offsets, nruns) != 0)
+        return -1;
+
+    if (nruns == 0) /* have nothing to merge */
+        return 0;
+
+    context_t ctx = _ctx_init(base + run_offsets[0] * sz, run_offsets[nruns] - run_offsets[0], sz, cmp, thunk, NULL, NULL);
+
+    return _F(kway_merge_runs)(&ctx, dst, run_offsets, nruns);
+}
+
+int pmr_sort_appended_r(void * base, size_t n_sorted, size_t n_total, size_t sz, void * thunk, int (*cmp)(void *, const void *, const void *))
+{
+    return pmr_sort_appended_ex(base, n_sorted, n_total, sz, thunk, cmp, NULL);
+}
+
+int pmr_sort_appended_ex(void * base, size_t n_sorted, size_t n_total, size_t sz, void * thunk, int (*cmp)(void *, const void *, const void *), const pmr_options_t * opts)
+{
+    if (n_sorted > n_total)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (n_sorted == n_total) /* have nothing to sort */
+        return 0;
+
+    context_t ctx = _ctx_init(base, n_total, sz, cmp, thunk, thPool(), opts);
+
+    return _D(&ctx, sort_appended)(&ctx, n_sorted, opts != NULL && (opts->flags & PMR_INPLACE) != 0);
+}
+
+int pmr_extsort_r(const char * src, const char * dst, size_t sz, void * thunk, int (*cmp)(void *, const void *, const void *), const pmr_options_t * opts)
+{
+    if (src == NULL || dst == NULL || sz == 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    context_t ctx = _ctx_init(NULL, 0, sz, cmp, thunk, thPool(), opts);
+    extsort_t es = { &ctx, _D(&ctx, pmergesort), _D(&ctx, symmergesort), _D(&ctx, kway_merge_spans), _D(&ctx, kway_cut), opts != NULL && opts->mem_budget != 0 ? opts->mem_budget : _PMR_EXTSORT_BUDGET, opts != NULL ? opts->tmpdir : NULL };
+
+    return _extsort_result(_extsort(&es, src, dst));
+}
+
+int pmr_sort_file_r(const char * path, size_t sz, void * thunk, int (*cmp)(void *, const void *, const void *), const pmr_options_t * opts)
+{
+    if (path == NULL || sz == 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    void * base;
+    size_t n;
+
+    int fd = _mapfile_open(path, sz, &base, &n);
+    if (fd < 0)
+        return -1;
+
+    int rc = 0;
+    if (n >= 2)
+    {
+        context_t ctx = _ctx_init(base, n, sz, cmp, thunk, thPool(), opts);
+
+        rc = _extsort_rc(_mapfile_inplace(n, sz, opts) ? _D(&ctx, symmergesort)(&ctx) : _D(&ctx, pmergesort)(&ctx));
+    }
+
+    return _extsort_result(_mapfile_close(fd, base, n * sz, rc));
+}
+
+int pmr_sort_by_key_r(void * keys, size_t n, size_t key_sz, void * thunk, int (*cmp)(void *, const void *, const void *),
+                        void * const * payloads, const size_t * payload_sz, size_t npayloads)
+{
+    if (n < 2) /* have nothing to sort */
+        return 0;
+
+    bykey_t bk;
+    if (_bykey_open(&bk, keys, n, key_sz) != 0)
+        return 1;
+
+    context_t ctx = _ctx_init(bk.recs, n, bk.rsz, cmp, thunk, thPool(), NULL);
+
+    int rc = _F(pmergesort)(&ctx);
+    if (rc != 0)
+    {
+        PMR_FREE(bk.recs);
+        return rc;
+    }
+
+    return _bykey_close(&bk, payloads, payload_sz, npayloads);
+}
+
+size_t pmr_compact(void * base, size_t n, size_t sz, void * thunk, int (*deleted)(void * thunk, const void * elt))
+{
+    if (n == 0) /* have nothing to compact */
+        return 0;
+
+    context_t ctx = _ctx_init(base, n, sz, NULL, thunk, NULL, NULL);
+
+    return _F(compact)(&ctx, deleted);
+}
+
+size_t pmr_sort_unique_r(void * base, size_t n, size_t sz, void * thunk, int (*cmp)(void *, const void *, const void *),
+                            void (*reduce)(void * thunk, void * acc, const void * dup))
+{
+    if (n < 2) /* have nothing to sort */
+        return n;
+
+    context_t ctx = _ctx_init(base, n, sz, cmp, thunk, thPool(), NULL);
+
+    size_t m;
+    if (_F(sort_unique)(&ctx, reduce, &m) != 0)
+    {
+        errno = ENOMEM;
+        return (size_t)-1;
+    }
+
+    return m;
+}
+
+int pmr_segmented_sort_r(void * base, const size_t * offsets, size_t nsegments, size_t sz, void * thunk,
+                            int (*cmp)(void *, const void *, const void *))
+{
+    if (_runs_check(offsets, nsegments) != 0)
+        return -1;
+
+    size_t n = nsegments > 0 ? offsets[nsegments] - offsets[0] : 0;
+    if (n < 2) /* have nothing to sort */
+        return 0;
+
+    context_t ctx = _ctx_init(base + offsets[0] * sz, n, sz, cmp, thunk, thPool(), NULL);
+
+    return _F(segmented_sort)(&ctx, offsets, nsegments);
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+int symmergesort_ex(void * base, size_t n, size_t sz, void * thunk, int (*cmp)(void *, const void *, const void *), const pmr_options_t * opts)
+{
+    if (n < 2) /* have nothing to sort */
+        return 0;
+
+    context_t ctx = _ctx_init(base, n, sz, cmp, thunk, thPool(), opts);
+
+    return _D(&ctx, symmergesort)(&ctx);
+}
+
+int pmergesort_ex(void * base, size_t n, size_t sz, void * thunk, int (*cmp)(void *, const void *, const void *), const pmr_options_t * opts)
+{
+    if (n < 2) /* have nothing to sort */
+        return 0;
+
+    context_t ctx = _ctx_init(base, n, sz, cmp, thunk, thPool(), opts);
+
+    return _D(&ctx, pmergesort)(&ctx);
+}
+
+int wrapmergesort_ex(void * base, size_t n, size_t sz, void * thunk, int (*cmp)(void *, const void *, const void *), int (*sort_r)(void *, size_t, size_t, void *, int (*)(void *, const void *, const void *)), const pmr_options_t * opts)
+{
+    if (n < 2) /* have nothing to sort */
+        return 0;
+
+    context_t ctx = _ctx_init(base, n, sz, cmp, thunk, thPool(), opts);
+    ctx.wsort = sort_r;
+
+    return _D(&ctx, wrapmergesort)(&ctx);
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+pmr_keyspec_t * pmr_keyspec_create(const pmr_key_t * keys, size_t nkeys)
+{
+    return _keyspec_compile(keys, nkeys);
+}
+
+void pmr_keyspec_destroy(pmr_keyspec_t * spec)
+{
+    PMR_FREE(spec);
+}
+
+int pmr_keyspec_cmp(void * spec, const void * a, const void * b)
+{
+    return ((pmr_keyspec_t *)spec)->cmp(spec, a, b);
+}
+
+void symmergesort_keys(void * base, size_t n, size_t sz, const pmr_keyspec_t * spec)
+{
+    if (n < 2) /* have nothing to sort */
+        return;
+
+    context_t ctx = _ctx_init(base, n, sz, spec->cmp, spec, thPool(), NULL);
+
+    (void)_F(symmergesort)(&ctx);
+}
+
+int pmergesort_keys(void * base, size_t n, size_t sz, const pmr_keyspec_t * spec)
+{
+    if (n < 2) /* have nothing to sort */
+        return 0;
+
+    context_t ctx = _ctx_init(base, n, sz, spec->cmp, spec, thPool(), NULL);
+
+    return _F(pmergesort)(&ctx);
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+int pmergesort_prefix(void ** base, size_t n, void * thunk, int (*cmp)(void *, const void *, const void *),
+                        uint64_t (*prefix)(void *, const void *))
+{
+    if (n < 2) /* have nothing to sort */
+        return 0;
+
+    prefix_pair_t * pairs = PMR_MALLOC(sizeof(prefix_pair_t) * n);
+    if (pairs == NULL)
+        return 1;
+
+#if _PMR_PARALLEL_MAY_SPAWN
+    int nchunks = scaleCPU(n, numCPU(), _PMR_PARALLEL_GRAIN);
+#else
+    int nchunks = 1;
+#endif
+
+    prefix_sort_t ps = { base, pairs, n, nchunks > 1 ? (size_t)nchunks : 1, thunk, cmp, prefix };
+
+    pmergesort_apply(ps.nchunks, _prefix_fill, &ps);
+
+    context_t ctx = _ctx_init(pairs, n, sizeof(prefix_pair_t), _prefix_cmp, &ps, thPool(), NULL);
+
+    int rc = _prefix_pmergesort(&ctx);
+    if (rc == 0)
+        pmergesort_apply(ps.nchunks, _prefix_store, &ps);
+
+    PMR_FREE(pairs);
+
+    return rc;
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+int pmergesort_str(const char ** base, size_t n)
+{
+    if (n < 2) /* have nothing to sort */
+        return 0;
+
+    return _str_sort(base, n);
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+pmr_stream_t * pmr_stream_create(size_t sz, void * thunk, int (*cmp)(void *, const void *, const void *), const pmr_options_t * opts)
+{
+    if (sz == 0 || cmp == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    context_t ctx = _ctx_init(NULL, 0, sz, cmp, thunk, NULL, opts); /* the deadline is of the stream */
+
+    return _stream_create(&ctx, _D(&ctx, pmergesort), _D(&ctx, kway_merge_spans), _D(&ctx, kway_cut), _D(&ctx, merge_runs), opts);
+}
+
+int pmr_stream_push(pmr_stream_t * stream, const void * elts, size_t n)
+{
+    return _extsort_result(_stream_push(stream, elts, n));
+}
+
+int pmr_stream_pull(pmr_stream_t * stream, void * dst, size_t max, size_t * n)
+{
+    return _extsort_result(_stream_pull(stream, dst, max, n));
+}
+
+void pmr_stream_destroy(pmr_stream_t * stream)
+{
+    if (stream != NULL)
+        _stream_destroy(stream);
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+pmr_async_t * pmergesort_async(void * base, size_t n, size_t sz, void * thunk, int (*cmp)(void *, const void *, const void *), const pmr_options_t * opts, void (*callback)(void * arg, int rc), void * arg)
+{
+#if PMR_PARALLEL_USE_PTHREADS
+    thr_pool_t * pool = asyncPool();
+    if (pool == NULL)
+        return NULL;
+
+    context_t ctx = _ctx_init(base, n, sz, cmp, thunk, pool, opts);
+#elif PMR_PARALLEL_USE_GCD
+    context_t ctx = _ctx_init(base, n, sz, cmp, thunk, NULL, opts);
+#else
+    context_t ctx = _ctx_init(base, n, sz, cmp, thunk, thPool(), opts);
+#endif
+
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS
+    int ncpu = ctx.ncpu;
+
+    /* handle, per-chunk aux data and pass descriptors at once */
+    pmr_async_t * async = PMR_MALLOC(sizeof(pmr_async_t) + (sizeof(aux_t) + sizeof(pmergesort_pass_context_t)) * ncpu);
+#else
+    pmr_async_t * async = PMR_MALLOC(sizeof(pmr_async_t));
+#endif
+    if (async == NULL)
+    {
+#if PMR_PARALLEL_USE_PTHREADS
+        asyncPool_release(pool);
+#endif
+        errno = ENOMEM;
+        return NULL;
+    }
+
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS
+    (void)pthread_mutex_init(&async->mutex, NULL);
+    (void)pthread_cond_init(&async->cond, NULL);
+#endif
+    async->refs = 2;
+    async->done = 0;
+    async->rc = 0;
+    async->callback = callback;
+    async->arg = arg;
+
+#if PMR_PARALLEL_USE_PTHREADS
+    async->pool = pool;
+
+    ctx.async = async;
+#elif PMR_PARALLEL_USE_GCD
+    async->dispatch.queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, _PMR_DISPATCH_QUEUE_FLAGS);
+    async->dispatch.group = dispatch_group_create();
+#if _PMR_PARALLEL_MAY_SPAWN && !_PMR_GCD_OVERCOMMIT
+    async->dispatch.mutex = dispatch_semaphore_create(ncpu);
+#endif
+
+    ctx.thpool = &async->dispatch;
+    ctx.async = async;
+#endif
+    memcpy((void *)&async->ctx, &ctx, sizeof(ctx)); /* context has constant fields */
+
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS
+    async->auxes = (aux_t *)(async + 1);
+    async->pass_ctx = (pmergesort_pass_context_t *)(async->auxes + ncpu);
+    for (int i = 0; i < ncpu; i++)
+        async->auxes[i] = (aux_t){ .parent = &async->auxes[i] };
+
+#if _PMR_PARALLEL_MAY_SPAWN
+    _slab_init(&async->slab);
+    async->ctx.slab = &async->slab;
+#endif
+
+    if (n < 2) /* have nothing to sort */
+        _async_complete(async, 0);
+    else
+        _D(&async->ctx, pmergesort_async)(async);
+#else
+    /* no pool to run on, complete in place */
+    _async_complete(async, n < 2 ? 0 : _D(&async->ctx, pmergesort)(&async->ctx));
+#endif
+
+    return async;
+}
+
+int pmr_wait(pmr_async_t * async)
+{
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS
+    (void)pthread_mutex_lock(&async->mutex);
+    while (!async->done)
+        (void)pthread_cond_wait(&async->cond, &async->mutex);
+    (void)pthread_mutex_unlock(&async->mutex);
+#endif
+
+    int rc = async->rc;
+
+    _async_unref(async);
+
+    return rc;
+}
+
+int pmr_try_wait(pmr_async_t * async, int * rc)
+{
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS
+    (void)pthread_mutex_lock(&async->mutex);
+    int done = async->done;
+    (void)pthread_mutex_unlock(&async->mutex);
+#else
+    int done = async->done;
+#endif
+
+    if (!done)
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if (rc != NULL)
+        *rc = async->rc;
+
+    _async_unref(async);
+
+    return 0;
+}
+
+void pmr_detach(pmr_async_t * async)
+{
+    _async_unref(async);
+}
+
 /* -------------------------------------------------------------------------------------------------------------------------- */
 
 #undef CALL_SORT
@@ -1097,3 +2942,93 @@ int wrapmergesort_r(void * base, size_t n, size_t sz, void * thunk, int (*cmp)(v
 #undef SORT_IS_R
 
 /* -------------------------------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/* parallel loop on the threads of library (the back-end of C++ front-end)                                                    */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+int pmergesort_nthreads(void)
+{
+    int ncpu = numCPU();
+
+    return ncpu > 1 ? ncpu : 1;
+}
+
+#if PMR_PARALLEL_USE_PTHREADS
+struct _apply_job
+{
+    void            (*fn)(void *, size_t);
+    void *          arg;
+    size_t          i;
+};
+typedef struct _apply_job apply_job_t;
+
+static void * __apply_job(void * arg)
+{
+    apply_job_t * job = arg;
+
+    job->fn(job->arg, job->i);
+
+    return NULL;
+}
+#elif PMR_PARALLEL_USE_OMP
+static __attribute__((noinline)) void __apply_tasks(size_t n, void (*fn)(void *, size_t), void * arg)
+{
+    #pragma omp taskgroup
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            #pragma omp task default(none) firstprivate(fn, arg, i)
+            fn(arg, i);
+        }
+    }
+}
+#endif
+
+void pmergesort_apply(size_t n, void (*fn)(void *, size_t), void * arg)
+{
+#if PMR_PARALLEL_USE_PTHREADS
+    thr_pool_t * pool = n > 1 && numCPU() > 1 ? thPool() : NULL;
+
+    apply_job_t * jobs = pool != NULL ? PMR_MALLOC(sizeof(apply_job_t) * n) : NULL;
+    if (jobs == NULL)
+    {
+        for (size_t i = 0; i < n; i++)
+            fn(arg, i);
+
+        return;
+    }
+
+    for (size_t i = 1; i < n; i++)
+    {
+        jobs[i] = (apply_job_t){ fn, arg, i };
+
+        if (thr_pool_queue(pool, __apply_job, &jobs[i]) != 0)
+            fn(arg, i); /* failed to queue, do it in place */
+    }
+
+    fn(arg, 0); /* the calling thread takes its share */
+
+    thr_pool_wait(pool);
+
+    PMR_FREE(jobs);
+#elif PMR_PARALLEL_USE_GCD
+    dispatch_apply_f(n, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, _PMR_DISPATCH_QUEUE_FLAGS), arg, fn);
+#elif PMR_PARALLEL_USE_OMP
+    if (omp_in_parallel())
+        __apply_tasks(n, fn, arg); /* join the team of caller */
+    else
+    {
+        int ncpu = numCPU();
+
+        #pragma omp parallel num_threads(ncpu) default(none) shared(n, fn, arg)
+        #pragma omp single
+        __apply_tasks(n, fn, arg);
+    }
+#else
+    for (size_t i = 0; i < n; i++)
+        fn(arg, i);
+#endif
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
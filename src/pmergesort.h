@@ -10,6 +10,8 @@
 #ifndef _PMERGESORT_H
 #define _PMERGESORT_H
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -37,6 +39,233 @@ extern "C" {
                             int (*sort_r)(void *, size_t, size_t, void *, int (*)(void *, const void *, const void *)));
     /* ---------------------------------------------------------------------------------------------------------------------- */
 
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    /* stable partial sort: the least k elements in order at the front of array, the rest in unspecified order                */
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    int pmergesort_topk(void * base, size_t n, size_t sz, size_t k, int (*cmp)(const void *, const void *));
+    int pmergesort_topk_r(void * base, size_t n, size_t sz, size_t k, void * thunk, int (*cmp)(void *, const void *, const void *));
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    /* selection (parallel if configured, not stable): puts the element of rank k (or of every rank of ascending list ks) in  */
+    /* its sorted position, the lesser elements before and the greater ones after it; returns -1 with errno set to EINVAL if  */
+    /* a rank is out of range or not ascending                                                                                */
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    int pmr_select(void * base, size_t n, size_t sz, size_t k, int (*cmp)(const void *, const void *));
+    int pmr_select_r(void * base, size_t n, size_t sz, size_t k, void * thunk, int (*cmp)(void *, const void *, const void *));
+    int pmr_select_multi(void * base, size_t n, size_t sz, const size_t * ks, size_t nks, int (*cmp)(const void *, const void *));
+    int pmr_select_multi_r(void * base, size_t n, size_t sz, const size_t * ks, size_t nks, void * thunk,
+                            int (*cmp)(void *, const void *, const void *));
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    /* stable merge of pre-sorted runs (parallel if configured), run i is [run_offsets[i], run_offsets[i + 1]) of base, so    */
+    /* run_offsets has nruns + 1 ascending entries; in place, or k-way to dst of run_offsets[nruns] - run_offsets[0] elements */
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    int pmr_merge_runs(void * base, const size_t * run_offsets, size_t nruns, size_t sz, int (*cmp)(const void *, const void *));
+    int pmr_merge_runs_r(void * base, const size_t * run_offsets, size_t nruns, size_t sz, void * thunk,
+                            int (*cmp)(void *, const void *, const void *));
+    int pmr_kway_merge(void * dst, const void * base, const size_t * run_offsets, size_t nruns, size_t sz,
+                            int (*cmp)(const void *, const void *));
+    int pmr_kway_merge_r(void * dst, const void * base, const size_t * run_offsets, size_t nruns, size_t sz, void * thunk,
+                            int (*cmp)(void *, const void *, const void *));
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    /* sort of many independent segments at once (parallel if configured), segment i is [offsets[i], offsets[i + 1]) of base, */
+    /* so offsets has nsegments + 1 ascending entries                                                                         */
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    int pmr_segmented_sort(void * base, const size_t * offsets, size_t nsegments, size_t sz, int (*cmp)(const void *, const void *));
+    int pmr_segmented_sort_r(void * base, const size_t * offsets, size_t nsegments, size_t sz, void * thunk,
+                            int (*cmp)(void *, const void *, const void *));
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    /* incremental sort of growing sorted array: [n_sorted, n_total) is sorted and merged into sorted [0, n_sorted); batched  */
+    /* deletions are applied by compaction, which keeps order of the rest and returns its number                              */
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    int pmr_sort_appended(void * base, size_t n_sorted, size_t n_total, size_t sz, int (*cmp)(const void *, const void *));
+    int pmr_sort_appended_r(void * base, size_t n_sorted, size_t n_total, size_t sz, void * thunk,
+                            int (*cmp)(void *, const void *, const void *));
+    size_t pmr_compact(void * base, size_t n, size_t sz, void * thunk, int (*deleted)(void * thunk, const void * elt));
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    /* stable sort and unique: of equal elements the 1st one is kept, returns the number of kept ones or (size_t)-1 with      */
+    /* errno set on failure; reduce (may be NULL) combines every dropped one into the kept one, it must keep the key of acc    */
+    /* and be associative, since equals of parallel chunks are reduced in parts                                               */
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    size_t pmr_sort_unique(void * base, size_t n, size_t sz, int (*cmp)(const void *, const void *));
+    size_t pmr_sort_unique_r(void * base, size_t n, size_t sz, void * thunk, int (*cmp)(void *, const void *, const void *),
+                            void (*reduce)(void * thunk, void * acc, const void * dup));
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    /* stable sort of keys carrying columns of payload along (struct-of-arrays layout), column c is payloads[c] of n elements  */
+    /* of payload_sz[c] bytes each                                                                                            */
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    int pmr_sort_by_key(void * keys, size_t n, size_t key_sz, int (*cmp)(const void *, const void *),
+                            void * const * payloads, const size_t * payload_sz, size_t npayloads);
+    int pmr_sort_by_key_r(void * keys, size_t n, size_t key_sz, void * thunk, int (*cmp)(void *, const void *, const void *),
+                            void * const * payloads, const size_t * payload_sz, size_t npayloads);
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    /* compiled multi-column key specification: columns of element are compared in order, the spec is compiled to comparator  */
+    /* specialized by its shape; pmr_keyspec_cmp with the spec as thunk is the comparator for any reentrant function          */
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+#define PMR_KEY_I8                  1
+#define PMR_KEY_I16                 2
+#define PMR_KEY_I32                 3
+#define PMR_KEY_I64                 4
+#define PMR_KEY_U8                  5
+#define PMR_KEY_U16                 6
+#define PMR_KEY_U32                 7
+#define PMR_KEY_U64                 8
+#define PMR_KEY_F32                 9       /* NaN is null */
+#define PMR_KEY_F64                 10      /* NaN is null */
+#define PMR_KEY_STR                 11      /* const char * compared by strcmp, NULL is null */
+
+#define PMR_KEY_DESC                0x1     /* descending order of column */
+#define PMR_KEY_NULLS_FIRST         0x2     /* nulls go before other values (in either order), else after them */
+
+    typedef struct pmr_key
+    {
+        size_t                  offset;     /* offset of column in element */
+        unsigned int            type;       /* PMR_KEY_xxx */
+        unsigned int            flags;      /* PMR_KEY_DESC, PMR_KEY_NULLS_FIRST */
+    } pmr_key_t;
+
+    typedef struct pmr_keyspec pmr_keyspec_t;
+
+    pmr_keyspec_t * pmr_keyspec_create(const pmr_key_t * keys, size_t nkeys);  /* returns NULL with errno set on failure */
+    void pmr_keyspec_destroy(pmr_keyspec_t * spec);
+    int pmr_keyspec_cmp(void * spec, const void * a, const void * b);
+
+    void symmergesort_keys(void * base, size_t n, size_t sz, const pmr_keyspec_t * spec);
+    int pmergesort_keys(void * base, size_t n, size_t sz, const pmr_keyspec_t * spec);
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    /* stable sort of array of pointers to records by cached key prefixes: prefix maps record to 64-bit value consistent with  */
+    /* cmp (prefix(a) < prefix(b) implies cmp(a, b) < 0), and cmp of records is called on ties of prefixes only                 */
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    int pmergesort_prefix(void ** base, size_t n, void * thunk, int (*cmp)(void * thunk, const void * a, const void * b),
+                            uint64_t (*prefix)(void * thunk, const void * a));
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    /* stable sort of strings in strcmp order by LCP-aware merge sort (parallel if configured), comparisons skip the prefix   */
+    /* known to be shared                                                                                                     */
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    int pmergesort_str(const char ** base, size_t n);
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    /* extended interface, options structure must be zero-initialized before setting of fields; the int calls return 0 on     */
+    /* success, a positive PMR_Exxx result if the sort has failed or given up, or -1 with errno set on invalid arguments and  */
+    /* failures of I/O (errno is also set with PMR_Exxx results of pmr_extsort, pmr_sort_file and pmr_stream_xxx calls)       */
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+#define PMR_ENOMEM                  1       /* result of sort failed to allocate temporary storage */
+#define PMR_ECANCELED               2       /* result of sort cancelled by token */
+#define PMR_ETIMEDOUT               3       /* result of sort given up at deadline */
+
+#define PMR_INPLACE                 0x1     /* use no temporary storage of elements (pmr_sort_appended_ex, pmr_sort_file) */
+#define PMR_DESCENDING              0x2     /* sort in descending order of comparator, equal elements keep their order */
+
+    typedef struct pmr_options
+    {
+        unsigned int            cmp_cost;   /* approx. cost of comparator call in ns, 0 to let the library probe it */
+        const volatile int *    cancel;     /* cancellation token, the sort gives up once it is set non-zero (may be NULL) */
+        unsigned int            timeout_ms; /* the sort gives up in timeout since the call, 0 for no deadline */
+        unsigned int            flags;      /* PMR_xxx */
+        size_t                  mem_budget; /* memory of external and file sorts in bytes, 0 for default (256 MB) */
+        const char *            tmpdir;     /* directory of temporary files of external sort, NULL for $TMPDIR or /tmp */
+    } pmr_options_t;
+
+    int symmergesort_ex(void * base, size_t n, size_t sz, void * thunk, int (*cmp)(void *, const void *, const void *),
+                            const pmr_options_t * opts);
+    int pmergesort_ex(void * base, size_t n, size_t sz, void * thunk, int (*cmp)(void *, const void *, const void *),
+                            const pmr_options_t * opts);
+    int wrapmergesort_ex(void * base, size_t n, size_t sz, void * thunk, int (*cmp)(void *, const void *, const void *),
+                            int (*sort_r)(void *, size_t, size_t, void *, int (*)(void *, const void *, const void *)),
+                            const pmr_options_t * opts);
+    int pmr_extsort(const char * src, const char * dst, size_t sz, int (*cmp)(const void *, const void *),
+                            const pmr_options_t * opts);
+    int pmr_extsort_r(const char * src, const char * dst, size_t sz, void * thunk, int (*cmp)(void *, const void *, const void *),
+                            const pmr_options_t * opts);
+    int pmr_sort_appended_ex(void * base, size_t n_sorted, size_t n_total, size_t sz, void * thunk,
+                            int (*cmp)(void *, const void *, const void *), const pmr_options_t * opts);
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    /* in-place sort of file of fixed size records mapped to memory, sorted by symmergesort with PMR_INPLACE flag or if the   */
+    /* scratch of pmergesort would exceed mem_budget (no heap storage of elements), else by pmergesort; returns -1 with errno  */
+    /* set on failure of I/O                                                                                                  */
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    int pmr_sort_file(const char * path, size_t sz, int (*cmp)(const void *, const void *), const pmr_options_t * opts);
+    int pmr_sort_file_r(const char * path, size_t sz, void * thunk, int (*cmp)(void *, const void *, const void *),
+                            const pmr_options_t * opts);
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    /* push-based streaming stable sort: elements are pushed, then sorted output is pulled (the 1st pull ends the input);     */
+    /* memory is bounded by mem_budget of options, runs go to temporary files in tmpdir, timeout_ms is the deadline of the    */
+    /* stream since its creation; returns -1 with errno set on failure                                                        */
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    typedef struct pmr_stream pmr_stream_t;
+
+    pmr_stream_t * pmr_stream_create(size_t sz, void * thunk, int (*cmp)(void *, const void *, const void *),
+                                        const pmr_options_t * opts);
+
+    int pmr_stream_push(pmr_stream_t * stream, const void * elts, size_t n);
+    int pmr_stream_pull(pmr_stream_t * stream, void * dst, size_t max, size_t * n);   /* *n is 0 at the end of output */
+    void pmr_stream_destroy(pmr_stream_t * stream);
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    /* asynchronous out-of-place mergesort, returns NULL and sets errno on failure; the callback (may be NULL) is called on   */
+    /* completion, then the handle is released by pmr_wait, by pmr_try_wait once completed, or by pmr_detach                  */
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    typedef struct pmr_async pmr_async_t;
+
+    pmr_async_t * pmergesort_async(void * base, size_t n, size_t sz, void * thunk, int (*cmp)(void *, const void *, const void *),
+                                    const pmr_options_t * opts, void (*callback)(void * arg, int rc), void * arg);
+
+    int pmr_wait(pmr_async_t * async);                  /* waits for completion, returns result of sort */
+    int pmr_try_wait(pmr_async_t * async, int * rc);    /* returns 0 if completed, -1 with errno set to EBUSY if not */
+    void pmr_detach(pmr_async_t * async);               /* releases the handle without waiting */
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    /* scheduling and placement of worker threads (pthreads based pool only)                                                  */
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+#define PMR_SCHED_INHERIT           (-1)    /* keep scheduling policy of the thread which creates the pool */
+
+#define PMR_AFFINITY_NONE           0       /* do not pin workers */
+#define PMR_AFFINITY_CPUSET         1       /* pin workers round-robin to the given CPUs */
+#define PMR_AFFINITY_CORES          2       /* pin workers one per physical core, SMT siblings are skipped */
+
+    typedef struct pmergesort_workers
+    {
+        int             policy;     /* SCHED_OTHER, SCHED_RR, SCHED_FIFO, etc., or PMR_SCHED_INHERIT */
+        int             priority;   /* static priority within the policy */
+        int             nice;       /* nice value of workers where supported, 0 to keep */
+        int             affinity;   /* PMR_AFFINITY_xxx */
+        const int *     cpus;       /* CPUs to pin with PMR_AFFINITY_CPUSET, or to restrict PMR_AFFINITY_CORES (may be NULL) */
+        size_t          ncpus;      /* number of CPUs in list */
+    } pmergesort_workers_t;
+
+    int pmergesort_workers(const pmergesort_workers_t * workers);
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    /* parallel loop on the threads of library, calls fn(arg, i) for i in [0, n) and waits (back-end of pmergesort.hpp)       */
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    int pmergesort_nthreads(void);
+    void pmergesort_apply(size_t n, void (*fn)(void * arg, size_t i), void * arg);
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,563 @@
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  pmergesort.hpp                                                                                                            */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  Created by Cyril Murzin                                                                                                   */
+/*  Copyright (c) 2015-2017 Ravel Developers Group. All rights reserved.                                                      */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+/*  C++17 template front-end: the algorithms of pmergesort-core.inl over random-access iterators, so comparator and           */
+/*  projection are inlined and elements are moved by their move constructor/assignment instead of raw bytes                   */
+/*                                                                                                                            */
+/*  passes run on the threads of library (see pmergesort_apply), define PMR_HPP_SERIAL to use the header stand-alone          */
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+#ifndef _PMERGESORT_HPP
+#define _PMERGESORT_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#ifndef PMR_HPP_SERIAL
+#include "pmergesort.h"
+#endif
+
+namespace pmr
+{
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    /* default projection                                                                                                     */
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    struct identity
+    {
+        template <class T>
+        constexpr T && operator()(T && t) const noexcept
+        {
+            return std::forward<T>(t);
+        }
+    };
+
+    namespace detail
+    {
+        constexpr std::ptrdiff_t blocklen = 32;     /* length of block to pre-sort, see _PMR_BLOCKLEN_SYMMERGE */
+        constexpr std::ptrdiff_t grain = 4096;      /* min. number of elements per thread, see _PMR_PARALLEL_GRAIN */
+
+        /* ------------------------------------------------------------------------------------------------------------------ */
+        /* comparator applied to projections                                                                                  */
+        /* ------------------------------------------------------------------------------------------------------------------ */
+        template <class Comp, class Proj>
+        struct pred
+        {
+            Comp &  comp;
+            Proj &  proj;
+
+            template <class A, class B>
+            bool operator()(A && a, B && b) const
+            {
+                return std::invoke(comp, std::invoke(proj, std::forward<A>(a)), std::invoke(proj, std::forward<B>(b)));
+            }
+        };
+
+        /* ------------------------------------------------------------------------------------------------------------------ */
+        /* run f(i) for i in [0, n) on the threads of library, rethrow the 1st exception thrown by f                          */
+        /* ------------------------------------------------------------------------------------------------------------------ */
+        inline int nthreads()
+        {
+#ifdef PMR_HPP_SERIAL
+            return 1;
+#else
+            return pmergesort_nthreads();
+#endif
+        }
+
+        template <class F>
+        void parallel_for(std::size_t n, F & f)
+        {
+#ifndef PMR_HPP_SERIAL
+            if (n > 1)
+            {
+                struct job
+                {
+                    F &                 f;
+                    std::atomic<bool>   failed;
+                    std::mutex          mutex;
+                    std::exception_ptr  error;
+                } j { f, { false }, {}, {} };
+
+                pmergesort_apply(n, [](void * arg, std::size_t i)
+                {
+                    job * j = static_cast<job *>(arg);
+                    if (j->failed.load(std::memory_order_relaxed))
+                        return; /* bail out */
+
+                    try
+                    {
+                        j->f(i);
+                    }
+                    catch (...)
+                    {
+                        std::lock_guard<std::mutex> lock(j->mutex);
+                        if (!j->error)
+                            j->error = std::current_exception();
+
+                        j->failed.store(true, std::memory_order_relaxed);
+                    }
+                }, &j);
+
+                if (j.error)
+                    std::rethrow_exception(j.error);
+
+                return;
+            }
+#endif
+
+            for (std::size_t i = 0; i < n; i++)
+                f(i);
+        }
+
+        /* number of threads worth to wake for n elements, see scaleCPU() */
+        inline int scale(std::ptrdiff_t n)
+        {
+            std::ptrdiff_t nmax = n / grain;
+            if (nmax < 2)
+                return 1;
+
+            int ncpu = nthreads();
+
+            return nmax < ncpu ? (int)nmax : ncpu;
+        }
+
+        inline std::ptrdiff_t div_up(std::ptrdiff_t n, std::ptrdiff_t m)
+        {
+            return (n + m - 1) / m;
+        }
+
+        /* ------------------------------------------------------------------------------------------------------------------ */
+        /* binary insertion sort                                                                                              */
+        /* ------------------------------------------------------------------------------------------------------------------ */
+        template <class It, class Less>
+        void insertion_sort(It first, It last, Less & less)
+        {
+            if (first == last)
+                return;
+
+            for (It i = std::next(first); i != last; ++i)
+            {
+                if (!less(*i, *std::prev(i)))
+                    continue; /* in place already */
+
+                std::rotate(std::upper_bound(first, i, *i, less), i, std::next(i));
+            }
+        }
+
+        /* ------------------------------------------------------------------------------------------------------------------ */
+        /* pre-sort blocks of blocklen, one chunk of blocks per thread                                                        */
+        /* ------------------------------------------------------------------------------------------------------------------ */
+        template <class It, class Less>
+        void sort_blocks(It first, std::ptrdiff_t n, int nthr, Less & less)
+        {
+            std::ptrdiff_t chunksz = div_up(div_up(n, nthr), blocklen) * blocklen;
+
+            auto chunk_pass = [&](std::size_t chunk)
+            {
+                std::ptrdiff_t lo = chunksz * (std::ptrdiff_t)chunk;
+                std::ptrdiff_t hi = std::min(n, lo + chunksz);
+
+                for (std::ptrdiff_t a = lo; a < hi; a += blocklen)
+                    insertion_sort(first + a, first + std::min(hi, a + blocklen), less);
+            };
+
+            parallel_for((std::size_t)div_up(n, chunksz), chunk_pass);
+        }
+
+        /* ------------------------------------------------------------------------------------------------------------------ */
+        /* one step of SymMerge algorithm (see _(inplace_symmerge)), both segments are at least of 2 elements:                */
+        /* rotates side-changing elements and returns the bounds [start, end) of them, so [first, start) || [start, mid)      */
+        /* and [mid, end) || [end, last) remain to merge, where mid is first + (last - first) / 2                             */
+        /* ------------------------------------------------------------------------------------------------------------------ */
+        template <class It, class Less>
+        std::pair<It, It> symmerge_step(It first, It middle, It last, Less & less)
+        {
+            std::ptrdiff_t m = middle - first;
+            std::ptrdiff_t mid = (last - first) >> 1;
+            std::ptrdiff_t n = mid + m;
+
+            std::ptrdiff_t start, r;
+            if (m > mid)
+            {
+                start = n - (last - first);
+                r = mid;
+            }
+            else
+            {
+                start = 0;
+                r = m;
+            }
+
+            std::ptrdiff_t p = n - 1;
+            while (start < r)
+            {
+                std::ptrdiff_t c = (start + r) >> 1;
+                if (!less(first[p - c], first[c]))
+                    start = c + 1;
+                else
+                    r = c;
+            }
+
+            std::ptrdiff_t end = n - start;
+            if (start < m && m < end)
+                std::rotate(first + start, middle, first + end);
+
+            return { first + start, first + end };
+        }
+
+        /* ------------------------------------------------------------------------------------------------------------------ */
+        /* merge a single element with segment, returns true if done                                                          */
+        /* ------------------------------------------------------------------------------------------------------------------ */
+        template <class It, class Less>
+        bool symmerge_trivial(It first, It middle, It last, Less & less)
+        {
+            if (first == middle || middle == last)
+                return true;
+
+            if (middle - first == 1)
+            {
+                std::rotate(first, middle, std::lower_bound(middle, last, *first, less));
+                return true;
+            }
+
+            if (last - middle == 1)
+            {
+                std::rotate(std::upper_bound(first, middle, *middle, less), middle, last);
+                return true;
+            }
+
+            return false;
+        }
+
+        /* ------------------------------------------------------------------------------------------------------------------ */
+        /* merge two sorted segments in place: [first, middle) || [middle, last) => [first, last)                             */
+        /* ------------------------------------------------------------------------------------------------------------------ */
+        template <class It, class Less>
+        void symmerge(It first, It middle, It last, Less & less)
+        {
+            while (!symmerge_trivial(first, middle, last, less))
+            {
+                It mid = first + ((last - first) >> 1);
+                std::pair<It, It> se = symmerge_step(first, middle, last, less);
+
+                symmerge(first, se.first, mid, less);
+
+                /* merge the 2nd subsegments here instead of recurrent call */
+                first = mid;
+                middle = se.second;
+            }
+        }
+
+        /* ------------------------------------------------------------------------------------------------------------------ */
+        /* merge two sorted segments out of place by moves                                                                    */
+        /* ------------------------------------------------------------------------------------------------------------------ */
+        template <class In, class Out, class Less>
+        Out move_merge(In a, In ae, In b, In be, Out out, Less & less)
+        {
+            while (a != ae && b != be)
+            {
+                if (less(*b, *a))
+                    *out = std::move(*b++);
+                else
+                    *out = std::move(*a++);
+
+                ++out;
+            }
+
+            return std::move(b, be, std::move(a, ae, out));
+        }
+
+        /* ------------------------------------------------------------------------------------------------------------------ */
+        /* number of elements of a among the first d elements of stable merge of a and b (merge path)                         */
+        /* ------------------------------------------------------------------------------------------------------------------ */
+        template <class In, class Less>
+        std::ptrdiff_t corank(std::ptrdiff_t d, In a, std::ptrdiff_t na, In b, std::ptrdiff_t nb, Less & less)
+        {
+            std::ptrdiff_t lo = d > nb ? d - nb : 0;
+            std::ptrdiff_t hi = d < na ? d : na;
+
+            while (lo < hi)
+            {
+                std::ptrdiff_t i = lo + ((hi - lo) >> 1);
+                if (!less(b[d - i - 1], a[i]))
+                    lo = i + 1;
+                else
+                    hi = i;
+            }
+
+            return lo;
+        }
+
+        /* ------------------------------------------------------------------------------------------------------------------ */
+        /* merge pairs of runs of width bsz from src to dst: by chunks of pairs while there are more pairs than threads,      */
+        /* else every pair is split into equal pieces by merge path                                                           */
+        /* ------------------------------------------------------------------------------------------------------------------ */
+        template <class Src, class Dst, class Less>
+        void merge_level(Src src, Dst dst, std::ptrdiff_t n, std::ptrdiff_t bsz, int nthr, Less & less)
+        {
+            std::ptrdiff_t dbl_bsz = bsz << 1;
+            std::ptrdiff_t npercpu = div_up(n, nthr);
+
+            if (nthr == 1 || dbl_bsz < npercpu)
+            {
+                std::ptrdiff_t chunksz = div_up(npercpu, dbl_bsz) * dbl_bsz;
+
+                auto chunk_pass = [&](std::size_t chunk)
+                {
+                    std::ptrdiff_t lo = chunksz * (std::ptrdiff_t)chunk;
+                    std::ptrdiff_t hi = std::min(n, lo + chunksz);
+
+                    for (std::ptrdiff_t a = lo; a < hi; a += dbl_bsz)
+                    {
+                        std::ptrdiff_t mi = std::min(hi, a + bsz);
+                        std::ptrdiff_t b = std::min(hi, a + dbl_bsz);
+
+                        move_merge(src + a, src + mi, src + mi, src + b, dst + a, less);
+                    }
+                };
+
+                parallel_for((std::size_t)div_up(n, chunksz), chunk_pass);
+            }
+            else
+            {
+                struct piece
+                {
+                    std::ptrdiff_t  a, ae, b, be, out;
+                };
+
+                std::vector<piece> pieces;
+
+                for (std::ptrdiff_t lo = 0; lo < n; lo += dbl_bsz)
+                {
+                    std::ptrdiff_t mi = std::min(n, lo + bsz);
+                    std::ptrdiff_t hi = std::min(n, lo + dbl_bsz);
+
+                    std::ptrdiff_t len = hi - lo;
+                    std::ptrdiff_t k = div_up(len, npercpu);
+
+                    std::ptrdiff_t d0 = 0, i0 = 0;
+                    for (std::ptrdiff_t p = 1; p <= k; p++)
+                    {
+                        std::ptrdiff_t d1 = len * p / k;
+                        std::ptrdiff_t i1 = p < k ? corank(d1, src + lo, mi - lo, src + mi, hi - mi, less) : mi - lo;
+
+                        pieces.push_back({ lo + i0, lo + i1, mi + d0 - i0, mi + d1 - i1, lo + d0 });
+
+                        d0 = d1;
+                        i0 = i1;
+                    }
+                }
+
+                auto piece_pass = [&](std::size_t i)
+                {
+                    const piece & p = pieces[i];
+
+                    move_merge(src + p.a, src + p.ae, src + p.b, src + p.be, dst + p.out, less);
+                };
+
+                parallel_for(pieces.size(), piece_pass);
+            }
+        }
+
+        /* ------------------------------------------------------------------------------------------------------------------ */
+        /* merge pairs of runs of width bsz in place: by chunks of pairs while there are more pairs than threads, else pairs  */
+        /* are split by SymMerge steps into independent merges until there are enough of them                                 */
+        /* ------------------------------------------------------------------------------------------------------------------ */
+        template <class It, class Less>
+        void symmerge_level(It first, std::ptrdiff_t n, std::ptrdiff_t bsz, int nthr, Less & less)
+        {
+            std::ptrdiff_t dbl_bsz = bsz << 1;
+            std::ptrdiff_t npercpu = div_up(n, nthr);
+
+            if (nthr == 1 || dbl_bsz < npercpu)
+            {
+                std::ptrdiff_t chunksz = div_up(npercpu, dbl_bsz) * dbl_bsz;
+
+                auto chunk_pass = [&](std::size_t chunk)
+                {
+                    std::ptrdiff_t lo = chunksz * (std::ptrdiff_t)chunk;
+                    std::ptrdiff_t hi = std::min(n, lo + chunksz);
+
+                    for (std::ptrdiff_t a = lo; a < hi; a += dbl_bsz)
+                        symmerge(first + a, first + std::min(hi, a + bsz), first + std::min(hi, a + dbl_bsz), less);
+                };
+
+                parallel_for((std::size_t)div_up(n, chunksz), chunk_pass);
+            }
+            else
+            {
+                struct merge
+                {
+                    It  lo, mi, hi;
+                };
+
+                std::vector<merge> merges;
+                for (std::ptrdiff_t lo = 0; lo < n; lo += dbl_bsz)
+                    merges.push_back({ first + lo, first + std::min(n, lo + bsz), first + std::min(n, lo + dbl_bsz) });
+
+                /* split the longest merge until there are enough of them, or they are short enough */
+                auto longer = [](const merge & a, const merge & b) { return a.hi - a.lo < b.hi - b.lo; };
+
+                /* merges done by symmerge_trivial are dropped, all of them are on presorted input */
+                while (!merges.empty() && merges.size() < 4 * (std::size_t)nthr)
+                {
+                    auto it = std::max_element(merges.begin(), merges.end(), longer);
+                    if (it->hi - it->lo < 2 * grain)
+                        break;
+
+                    merge m = *it;
+                    merges.erase(it);
+
+                    if (symmerge_trivial(m.lo, m.mi, m.hi, less))
+                        continue;
+
+                    It mid = m.lo + ((m.hi - m.lo) >> 1);
+                    std::pair<It, It> se = symmerge_step(m.lo, m.mi, m.hi, less);
+
+                    merges.push_back({ m.lo, se.first, mid });
+                    merges.push_back({ mid, se.second, m.hi });
+                }
+
+                auto merge_pass = [&](std::size_t i)
+                {
+                    symmerge(merges[i].lo, merges[i].mi, merges[i].hi, less);
+                };
+
+                parallel_for(merges.size(), merge_pass);
+            }
+        }
+
+        /* ------------------------------------------------------------------------------------------------------------------ */
+        /* temporary storage of constructed elements                                                                          */
+        /* ------------------------------------------------------------------------------------------------------------------ */
+        template <class T>
+        struct buffer
+        {
+            T *             data;
+            std::ptrdiff_t  n;
+
+            /* takes allocated storage and moves elements there */
+            template <class It>
+            buffer(T * data, It first, std::ptrdiff_t n) : data(data), n(n)
+            {
+                try
+                {
+                    std::uninitialized_move(first, first + n, data);
+                }
+                catch (...)
+                {
+                    std::allocator<T>().deallocate(data, (std::size_t)n);
+                    throw;
+                }
+            }
+
+            ~buffer()
+            {
+                std::destroy(data, data + n);
+                std::allocator<T>().deallocate(data, (std::size_t)n);
+            }
+
+            buffer(const buffer &) = delete;
+            buffer & operator=(const buffer &) = delete;
+        };
+
+        template <class It, class Less>
+        void inplace_stable_sort(It first, It last, Less & less)
+        {
+            std::ptrdiff_t n = last - first;
+            int nthr = scale(n);
+
+            sort_blocks(first, n, nthr, less);
+
+            for (std::ptrdiff_t bsz = blocklen; bsz < n; bsz <<= 1)
+                symmerge_level(first, n, bsz, nthr, less);
+        }
+    }
+
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    /* inplace mergesort based on symmerge algorithm (parallel if library is configured so)                                   */
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    template <class It, class Comp = std::less<>, class Proj = identity>
+    void inplace_stable_sort(It first, It last, Comp comp = {}, Proj proj = {})
+    {
+        if (last - first < 2)
+            return; /* have nothing to sort */
+
+        detail::pred<Comp, Proj> less { comp, proj };
+
+        detail::inplace_stable_sort(first, last, less);
+    }
+
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    /* mergesort with temporary storage of n elements, falls back to inplace one if storage is not available                  */
+    /* (parallel if library is configured so)                                                                                 */
+    /* ---------------------------------------------------------------------------------------------------------------------- */
+    template <class It, class Comp = std::less<>, class Proj = identity>
+    void stable_sort(It first, It last, Comp comp = {}, Proj proj = {})
+    {
+        using T = typename std::iterator_traits<It>::value_type;
+
+        std::ptrdiff_t n = last - first;
+        if (n < 2)
+            return; /* have nothing to sort */
+
+        detail::pred<Comp, Proj> less { comp, proj };
+
+        if (n <= detail::blocklen)
+        {
+            detail::insertion_sort(first, last, less);
+            return;
+        }
+
+        int nthr = detail::scale(n);
+
+        detail::sort_blocks(first, n, nthr, less);
+
+        T * data;
+        try
+        {
+            data = std::allocator<T>().allocate((std::size_t)n);
+        }
+        catch (const std::bad_alloc &)
+        {
+            /* the blocks are sorted already */
+            for (std::ptrdiff_t bsz = detail::blocklen; bsz < n; bsz <<= 1)
+                detail::symmerge_level(first, n, bsz, nthr, less);
+
+            return;
+        }
+
+        detail::buffer<T> temp(data, first, n);
+
+        /* ping-pong between temporary storage (holding elements now) and array */
+        bool in_temp = true;
+        for (std::ptrdiff_t bsz = detail::blocklen; bsz < n; bsz <<= 1, in_temp = !in_temp)
+        {
+            if (in_temp)
+                detail::merge_level(temp.data, first, n, bsz, nthr, less);
+            else
+                detail::merge_level(first, temp.data, n, bsz, nthr, less);
+        }
+
+        if (in_temp)
+            std::move(temp.data, temp.data + n, first);
+    }
+}
+
+#endif
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
@@ -100,28 +100,24 @@
 /* -------------------------------------------------------------------------------------------------------------------------- */
 /* -------------------------------------------------------------------------------------------------------------------------- */
 
-static inline void _F(symmergesort)(context_t * ctx)
+static inline int _F(symmergesort)(context_t * ctx)
 {
     switch (ctx->sz)
     {
 #if _PMR_USE_4_MEM
     case 4:
-        _F(_symmergesort_4)(ctx);
-        break;
+        return _F(_symmergesort_4)(ctx);
 #endif
 #if _PMR_USE_8_MEM
     case 8:
-        _F(_symmergesort_8)(ctx);
-        break;
+        return _F(_symmergesort_8)(ctx);
 #endif
 #if _PMR_USE_16_MEM
     case 16:
-        _F(_symmergesort_16)(ctx);
-        break;
+        return _F(_symmergesort_16)(ctx);
 #endif
     default:
-        _F(_symmergesort_sz)(ctx);
-        break;
+        return _F(_symmergesort_sz)(ctx);
     }
 }
 
@@ -150,6 +146,265 @@ static inline int _F(pmergesort)(context_t * ctx)
 
 /* -------------------------------------------------------------------------------------------------------------------------- */
 
+static inline int _F(pmergesort_topk)(context_t * ctx, size_t k)
+{
+    switch (ctx->sz)
+    {
+#if _PMR_USE_4_MEM
+    case 4:
+        return _F(_pmergesort_topk_4)(ctx, k);
+#endif
+#if _PMR_USE_8_MEM
+    case 8:
+        return _F(_pmergesort_topk_8)(ctx, k);
+#endif
+#if _PMR_USE_16_MEM
+    case 16:
+        return _F(_pmergesort_topk_16)(ctx, k);
+#endif
+    default:
+        return _F(_pmergesort_topk_sz)(ctx, k);
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+static inline int _F(pmr_select)(context_t * ctx, const size_t * ks, size_t nks)
+{
+    switch (ctx->sz)
+    {
+#if _PMR_USE_4_MEM
+    case 4:
+        return _F(_pmr_select_4)(ctx, ks, nks);
+#endif
+#if _PMR_USE_8_MEM
+    case 8:
+        return _F(_pmr_select_8)(ctx, ks, nks);
+#endif
+#if _PMR_USE_16_MEM
+    case 16:
+        return _F(_pmr_select_16)(ctx, ks, nks);
+#endif
+    default:
+        return _F(_pmr_select_sz)(ctx, ks, nks);
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+static inline int _F(merge_runs)(context_t * ctx, const size_t * offs, size_t nruns, int inplace)
+{
+    switch (ctx->sz)
+    {
+#if _PMR_USE_4_MEM
+    case 4:
+        return _F(_merge_runs_4)(ctx, offs, nruns, inplace);
+#endif
+#if _PMR_USE_8_MEM
+    case 8:
+        return _F(_merge_runs_8)(ctx, offs, nruns, inplace);
+#endif
+#if _PMR_USE_16_MEM
+    case 16:
+        return _F(_merge_runs_16)(ctx, offs, nruns, inplace);
+#endif
+    default:
+        return _F(_merge_runs_sz)(ctx, offs, nruns, inplace);
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+static inline int _F(kway_merge_runs)(context_t * ctx, void * dst, const size_t * offs, size_t nruns)
+{
+    switch (ctx->sz)
+    {
+#if _PMR_USE_4_MEM
+    case 4:
+        return _F(_kway_merge_runs_4)(ctx, dst, offs, nruns);
+#endif
+#if _PMR_USE_8_MEM
+    case 8:
+        return _F(_kway_merge_runs_8)(ctx, dst, offs, nruns);
+#endif
+#if _PMR_USE_16_MEM
+    case 16:
+        return _F(_kway_merge_runs_16)(ctx, dst, offs, nruns);
+#endif
+    default:
+        return _F(_kway_merge_runs_sz)(ctx, dst, offs, nruns);
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+static inline int _F(kway_merge_spans)(context_t * ctx, void * dst, void * const * lo, void * const * hi, size_t nruns)
+{
+    switch (ctx->sz)
+    {
+#if _PMR_USE_4_MEM
+    case 4:
+        return _F(_kway_merge_spans_4)(ctx, dst, lo, hi, nruns);
+#endif
+#if _PMR_USE_8_MEM
+    case 8:
+        return _F(_kway_merge_spans_8)(ctx, dst, lo, hi, nruns);
+#endif
+#if _PMR_USE_16_MEM
+    case 16:
+        return _F(_kway_merge_spans_16)(ctx, dst, lo, hi, nruns);
+#endif
+    default:
+        return _F(_kway_merge_spans_sz)(ctx, dst, lo, hi, nruns);
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+static inline size_t _F(kway_cut)(context_t * ctx, void * const * lo, void ** hi, const int * tail, size_t nruns)
+{
+    switch (ctx->sz)
+    {
+#if _PMR_USE_4_MEM
+    case 4:
+        return _F(_kway_cut_4)(ctx, lo, hi, tail, nruns);
+#endif
+#if _PMR_USE_8_MEM
+    case 8:
+        return _F(_kway_cut_8)(ctx, lo, hi, tail, nruns);
+#endif
+#if _PMR_USE_16_MEM
+    case 16:
+        return _F(_kway_cut_16)(ctx, lo, hi, tail, nruns);
+#endif
+    default:
+        return _F(_kway_cut_sz)(ctx, lo, hi, tail, nruns);
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+static inline int _F(sort_appended)(context_t * ctx, size_t nsorted, int inplace)
+{
+    switch (ctx->sz)
+    {
+#if _PMR_USE_4_MEM
+    case 4:
+        return _F(_sort_appended_4)(ctx, nsorted, inplace);
+#endif
+#if _PMR_USE_8_MEM
+    case 8:
+        return _F(_sort_appended_8)(ctx, nsorted, inplace);
+#endif
+#if _PMR_USE_16_MEM
+    case 16:
+        return _F(_sort_appended_16)(ctx, nsorted, inplace);
+#endif
+    default:
+        return _F(_sort_appended_sz)(ctx, nsorted, inplace);
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+static inline size_t _F(compact)(context_t * ctx, int (*deleted)(void *, const void *))
+{
+    switch (ctx->sz)
+    {
+#if _PMR_USE_4_MEM
+    case 4:
+        return _F(_compact_4)(ctx, deleted);
+#endif
+#if _PMR_USE_8_MEM
+    case 8:
+        return _F(_compact_8)(ctx, deleted);
+#endif
+#if _PMR_USE_16_MEM
+    case 16:
+        return _F(_compact_16)(ctx, deleted);
+#endif
+    default:
+        return _F(_compact_sz)(ctx, deleted);
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+static inline int _F(sort_unique)(context_t * ctx, void (*reduce)(void *, void *, const void *), size_t * m)
+{
+    switch (ctx->sz)
+    {
+#if _PMR_USE_4_MEM
+    case 4:
+        return _F(_sort_unique_4)(ctx, reduce, m);
+#endif
+#if _PMR_USE_8_MEM
+    case 8:
+        return _F(_sort_unique_8)(ctx, reduce, m);
+#endif
+#if _PMR_USE_16_MEM
+    case 16:
+        return _F(_sort_unique_16)(ctx, reduce, m);
+#endif
+    default:
+        return _F(_sort_unique_sz)(ctx, reduce, m);
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+static inline int _F(segmented_sort)(context_t * ctx, const size_t * offs, size_t nsegs)
+{
+    switch (ctx->sz)
+    {
+#if _PMR_USE_4_MEM
+    case 4:
+        return _F(_segmented_sort_4)(ctx, offs, nsegs);
+#endif
+#if _PMR_USE_8_MEM
+    case 8:
+        return _F(_segmented_sort_8)(ctx, offs, nsegs);
+#endif
+#if _PMR_USE_16_MEM
+    case 16:
+        return _F(_segmented_sort_16)(ctx, offs, nsegs);
+#endif
+    default:
+        return _F(_segmented_sort_sz)(ctx, offs, nsegs);
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
+#if PMR_PARALLEL_USE_GCD || PMR_PARALLEL_USE_PTHREADS
+static inline void _F(pmergesort_async)(pmr_async_t * async)
+{
+    switch (async->ctx.sz)
+    {
+#if _PMR_USE_4_MEM
+    case 4:
+        _F(_pmergesort_async_4)(async);
+        break;
+#endif
+#if _PMR_USE_8_MEM
+    case 8:
+        _F(_pmergesort_async_8)(async);
+        break;
+#endif
+#if _PMR_USE_16_MEM
+    case 16:
+        _F(_pmergesort_async_16)(async);
+        break;
+#endif
+    default:
+        _F(_pmergesort_async_sz)(async);
+        break;
+    }
+}
+#endif
+
+/* -------------------------------------------------------------------------------------------------------------------------- */
+
 static inline int _F(wrapmergesort)(context_t * ctx)
 {
     switch (ctx->sz)